@@ -0,0 +1,34 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <cstddef>
+#include <cstdint>
+
+//! deadline-aware quality: with a drain target the jobs waiting at any moment should be done
+//! within that many seconds; a job that starts while the queue would take longer at the normal
+//! LAME quality is encoded at a faster one, no faster than needed, and the quality returns to
+//! normal as the queue shrinks
+namespace backlog {
+  //! LAME qualities 0 to 9
+  const int num_qualities=10;
+
+  //! drain target in seconds for num_workers workers, 0 (the default) keeps the normal quality
+  void set_target(double seconds, unsigned num_workers);
+  double target();
+
+  //! quality for a job starting now with queued jobs waiting behind it
+  int quality(size_t queued, int normal);
+
+  //! accounts a finished job that took seconds at quality q
+  void record(double seconds, int q);
+
+  struct stats_t {
+    //! finished jobs per quality
+    uint64_t jobs[num_qualities];
+    //! jobs at a faster quality than the normal one
+    uint64_t degraded;
+  };
+
+  stats_t stats();
+}
+#endif
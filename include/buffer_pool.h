@@ -0,0 +1,48 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace buffer_pool {
+  //! move-only handle to a buffer taken from the calling thread's pool
+  //! the memory goes back to the pool of the releasing thread on destruction
+  class buffer {
+  public:
+    buffer() : data_(nullptr), capacity_(0) {}
+    explicit buffer(size_t size);
+    buffer(buffer&& other) : data_(other.data_), capacity_(other.capacity_) {
+      other.data_=nullptr;
+      other.capacity_=0;
+    }
+    buffer& operator=(buffer&& other);
+    buffer(const buffer& other) = delete;
+    buffer& operator=(const buffer& other) = delete;
+    ~buffer() {
+      reset();
+    }
+    uint8_t* get() const { return data_; }
+    size_t capacity() const { return capacity_; }
+    void reset();
+  private:
+    uint8_t* data_;
+    size_t capacity_;
+  };
+
+  struct stats_t {
+    uint64_t bytes_reused;
+    uint64_t bytes_allocated;
+    uint64_t num_reused;
+    uint64_t num_allocated;
+  };
+
+  //! counters summed over all threads
+  stats_t stats();
+
+  //! back buffers of 2 MiB and more with transparent huge pages (Linux only)
+  void set_huge_pages(bool enable);
+
+  //! upper bound for the bytes kept cached by each thread's pool
+  void set_max_cached(size_t bytes);
+}
+#endif
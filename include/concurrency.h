@@ -0,0 +1,64 @@
+#ifndef CONCURRENCY_H
+#define CONCURRENCY_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+//! adaptive worker count: a controller thread measures throughput (audio seconds converted per
+//! wall second) and how much of their time the workers spend blocked on I/O over windows of a
+//! few seconds, and moves the number of active workers between a lower and an upper bound by
+//! hill climbing; workers outside the active set park in admit()
+namespace concurrency {
+  struct settings {
+    unsigned min_workers;
+    unsigned max_workers;
+    //! active workers before the first decision
+    unsigned initial_workers;
+    //! length of a measurement window, one decision per window
+    double window_seconds;
+  };
+
+  //! starts the controller, every decision is passed to log as one line
+  void start(const settings& s, std::function<void(const std::string&)> log);
+
+  //! stops the controller and lets all parked workers through
+  void stop();
+
+  bool running();
+
+  //! parks worker index while it isn't one of the active workers; returns at once if the
+  //! controller isn't running
+  void admit(unsigned index);
+
+  //! lets all parked workers through for good, called once no more work is coming so that
+  //! they can see that and exit
+  void drain();
+
+  //! measures one job of the calling worker thread: wall time, CPU time, time waiting for a
+  //! CPU and the rest, which is time blocked on I/O (or locks)
+  class job_timer {
+  public:
+    //! does nothing while the controller isn't running
+    job_timer();
+    //! accounts the job to the current window
+    void finish(double audio_seconds);
+  private:
+    bool measuring_;
+    double wall_;
+    double cpu_;
+    double runnable_;
+  };
+
+  struct stats_t {
+    uint64_t decisions;
+    //! decisions that changed the number of active workers
+    uint64_t changes;
+    unsigned active;
+    unsigned fewest;
+    unsigned most;
+  };
+
+  stats_t stats();
+}
+#endif
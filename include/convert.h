@@ -1,7 +1,72 @@
 #ifndef CONVERT_H
 #define CONVERT_H
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
 #include <string>
+#include <vector>
+#include "downmix.h"
+#include "resample.h"
 namespace convert {
-  void convert(std::string filename_in, std::string filename_out);
+  struct settings {
+    //! user supplied downmix matrices, picked by number of input channels
+    //! files with more than 2 channels and no matching matrix use downmix::standard
+    std::vector<downmix::matrix> downmix_matrices;
+    //! resample to this rate before encoding instead of leaving it to LAME, which then encodes at
+    //! exactly this rate; 0 leaves the MP3 rate to LAME
+    unsigned out_sample_rate = 0;
+    resample::quality resample_quality = resample::quality::medium;
+    //! linear gain, output is clipped to full scale when it isn't 1
+    float gain = 1.0f;
+    //! deinterleave float and 32 bit input to planar float ourselves instead of
+    //! handing interleaved buffers to LAME
+    bool planar_float = true;
+    //! measure loudness and peaks while decoding and write them as ReplayGain
+    //! ID3v2 tags and/or to a sidecar file next to the output
+    bool loudness_tags = false;
+    bool loudness_sidecar = false;
+    //! linear threshold for trimming leading and trailing silence, negative disables trimming
+    float trim_threshold = -1;
+    //! bitrate ladder in kbps, each rung is encoded by its own thread from the same
+    //! decoded samples; empty means a single 128 kbps output at filename_out
+    std::vector<unsigned> bitrates;
+    //! output name of a rung, {name} is filename_out without ".mp3", {bitrate} the rung
+    std::string output_template = "{name}_{bitrate}k.mp3";
+    //! instead of one file, write segments of about this many seconds and an HLS playlist
+    //! (see segment::writer), 0 disables segmenting
+    double segment_seconds = 0;
+    //! LAME quality, 0 (best, slowest) to 9 (worst, fastest)
+    int quality = 2;
+    //! record the quality in an ID3v2 TXXX frame LAME_QUALITY of every output
+    bool quality_tag = false;
+  };
+
+  //! throws unless out_sample_rate, if set, is an MP3 sample rate and every bitrate (128 kbps
+  //! without a ladder) exists at it
+  void check_output_rate(const settings& s);
+
+  //! returns the duration of the encoded audio in seconds
+  double convert(std::string filename_in, std::string filename_out, const settings& s = settings());
+
+  //! same with the complete input file already read into data (see prefetch::reader)
+  double convert(const uint8_t* data, size_t size, std::string filename_out, const settings& s = settings());
+
+  //! upper estimate of the memory convert() needs at its peak for filename_in, from the file
+  //! size and the RIFF headers (sample format, channels, rate, data size) and s; files that are
+  //! converted with a single read are estimated from their size alone, without opening them
+  uint64_t estimate_memory(const std::string& filename_in, const settings& s = settings());
+  //! same for an input file already in memory, or one in a seekable stream of file_size bytes
+  uint64_t estimate_memory(const uint8_t* data, size_t size, const settings& s = settings());
+  uint64_t estimate_memory(std::istream& in, uint64_t file_size, const settings& s = settings());
+
+  //! converts a complete WAV file in a seekable stream to MP3 in out, which is cleared first
+  //! there is only one output, so bitrates, segment_seconds and loudness_sidecar are ignored
+  void convert(std::istream& in, std::vector<uint8_t>& out, const settings& s = settings());
+
+  //! converts a WAV stream to MP3 frames as the samples arrive, in blocks of one MP3 frame
+  //! with constant memory; accepts placeholder sizes in the headers, ignores everything in s
+  //! that needs the whole input (trimming, loudness, ladder, segments) and leaves
+  //! resampling to out_sample_rate to LAME
+  void convert_stream(std::istream& in, std::ostream& out, const settings& s = settings());
 }
 #endif
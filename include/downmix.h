@@ -0,0 +1,29 @@
+#ifndef DOWNMIX_H
+#define DOWNMIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace downmix {
+  //! out_channels x in_channels mixing coefficients, row major
+  struct matrix {
+    unsigned out_channels;
+    unsigned in_channels;
+    std::vector<float> coeffs;
+  };
+
+  //! stereo downmix for the speaker positions in a WAVE_FORMAT_EXTENSIBLE channel mask
+  //! centre and surround channels enter at -3 dB, LFE is dropped, channels without a position
+  //! are mixed to both sides; every row is scaled so its coefficients sum to 1 to avoid clipping
+  //! a mask of 0 means the default layout for the number of channels
+  matrix standard(unsigned num_channels, uint32_t channel_mask);
+
+  //! parses "a,b,c;d,e,f" into a matrix with one row per output channel
+  matrix parse(const std::string& s);
+
+  //! applies m to num_frames planar frames
+  void mix(const matrix& m, const float* const* in, float* const* out, size_t num_frames);
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef ENCODER_POOL_H
+#define ENCODER_POOL_H
+
+#include <memory>
+#include <cstdint>
+#include "lame.h"
+
+namespace encoder_pool {
+  //! everything that goes into lame_init_params, used as the pool key
+  struct settings {
+    int sample_rate;
+    //! MP3 sample rate, LAME resamples to it; 0 leaves the choice to LAME
+    int out_sample_rate;
+    int num_channels;
+    MPEG_mode mode;
+    int bitrate;
+    int quality;
+    //! no bit reservoir and no Xing/LAME tag frame, so every frame decodes on its own
+    bool segmented;
+    bool operator<(const settings& other) const;
+  };
+
+  using lgf_ptr = std::unique_ptr<lame_global_flags, decltype(&lame_close)>;
+
+  //! set lame flags in accordance with s and initialize the parameters
+  void set_lgf(lame_global_flags* lgf, const settings& s);
+
+  //! hands out a freshly initialized context for s
+  //! LAME can't reset a context after lame_encode_flush without carrying over encoder state,
+  //! so contexts are used once and replacements are prepared by a background thread
+  lgf_ptr acquire(const settings& s);
+
+  //! start the background thread keeping up to depth initialized contexts per recently used key
+  void start(int depth);
+
+  //! stop the background thread and close all prepared contexts
+  void stop();
+
+  struct stats_t {
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  stats_t stats();
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace loudness {
+  struct result {
+    //! EBU R128 / ITU-R BS.1770 integrated loudness in LUFS, -infinity for silence
+    double integrated;
+    //! linear peaks, the true peak is taken from a 4x oversampled signal
+    float sample_peak;
+    float true_peak;
+    //! samples at 16 bit full scale or beyond
+    uint64_t clipped;
+  };
+
+  //! ReplayGain 2.0 track gain in dB (reference level -18 LUFS)
+  double replaygain(const result& r);
+
+  //! result as a JSON object
+  std::string to_json(const result& r);
+
+  //! accumulates loudness and peaks over consecutive blocks of planar float samples
+  class meter {
+  public:
+    meter(unsigned sample_rate, unsigned num_channels);
+    void process(const float* const* samples, size_t num_frames);
+    result finish() const;
+  private:
+    struct biquad {
+      double b0, b1, b2, a1, a2;
+    };
+    struct channel_state {
+      // K-weighting filter states, direct form II transposed
+      double z[2][2];
+      // last input samples for the oversampling filter
+      std::vector<float> history;
+    };
+    double weighted_energy(channel_state& ch, const float* x, size_t n) const;
+    float oversampled_peak(channel_state& ch, const float* x, size_t n);
+
+    biquad stages_[2];
+    std::vector<channel_state> channels_;
+    size_t subblock_len_;
+    size_t subblock_fill_;
+    double subblock_energy_;
+    // mean square per 100 ms sub-block, summed over channels
+    std::vector<double> subblocks_;
+    double total_energy_;
+    uint64_t total_frames_;
+    float sample_peak_;
+    float true_peak_;
+    uint64_t clipped_;
+    std::vector<float> scratch_;
+    std::vector<float> acc_;
+  };
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <cstdint>
+
+//! admission control for concurrent conversions: every job reserves its estimated peak memory
+//! (see convert::estimate_memory) before it starts and the reservations together stay within
+//! the budget; a job larger than the whole budget runs when nothing else is reserved
+namespace memory_budget {
+  //! budget in bytes, 0 (the default) disables admission control
+  void set_limit(uint64_t bytes);
+  uint64_t limit();
+
+  //! reserves bytes if they fit next to the current reservations
+  bool try_acquire(uint64_t bytes);
+  //! reserves bytes, waiting for other jobs to release enough
+  void acquire(uint64_t bytes);
+  void release(uint64_t bytes);
+
+  //! releases a reservation made with try_acquire or acquire when it goes out of scope
+  class reservation {
+  public:
+    explicit reservation(uint64_t bytes) : bytes_(bytes) {}
+    reservation(const reservation& other) = delete;
+    ~reservation() {
+      release(bytes_);
+    }
+  private:
+    uint64_t bytes_;
+  };
+
+  struct stats_t {
+    //! largest total reservation
+    uint64_t peak;
+    //! jobs that had to wait for memory and the total time they waited
+    uint64_t waits;
+    double wait_ms;
+  };
+
+  stats_t stats();
+}
+#endif
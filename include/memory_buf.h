@@ -0,0 +1,27 @@
+#ifndef MEMORY_BUF_H
+#define MEMORY_BUF_H
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+
+//! seekable read only streambuf over a memory block, read_wav needs to seek
+class memory_buf : public std::streambuf {
+public:
+  memory_buf(const uint8_t* data, size_t size) {
+    char* p=(char*)data;
+    setg(p,p,p+size);
+  }
+protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+    char* base=dir==std::ios_base::beg ? eback() : dir==std::ios_base::cur ? gptr() : egptr();
+    if(off<eback()-base || off>egptr()-base)
+      return pos_type(off_type(-1));
+    setg(eback(),base+off,egptr());
+    return pos_type(gptr()-eback());
+  }
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos),std::ios_base::beg,which);
+  }
+};
+#endif
@@ -93,31 +93,31 @@ namespace memory_layout {
     expand_type { (host_to_be(args), 0)... };
   }
 
-  void pad_le(uint8_t* dst, uint8_t* src, int block_sz_in, int block_sz_out, int num_blocks);
+  void pad_le(uint8_t* dst, uint8_t* src, int block_sz_in, int block_sz_out, size_t num_blocks);
   
-  void pad_be(uint8_t* dst, uint8_t* src, int block_sz_in, int block_sz_out, int num_blocks);
+  void pad_be(uint8_t* dst, uint8_t* src, int block_sz_in, int block_sz_out, size_t num_blocks);
 
   template<typename T>
-  void le_to_host_arr(uint8_t* arr, int num_blocks) {
-    for(int i=0;i<num_blocks;++i)
+  void le_to_host_arr(uint8_t* arr, size_t num_blocks) {
+    for(size_t i=0;i<num_blocks;++i)
       le_to_host(*((T*)(arr+i*sizeof(T))));
   }
 
   template<typename T>
-  void be_to_host_arr(uint8_t* arr, int num_blocks) {
-    for(int i=0;i<num_blocks;++i)
+  void be_to_host_arr(uint8_t* arr, size_t num_blocks) {
+    for(size_t i=0;i<num_blocks;++i)
       be_to_host(*((T*)(arr+i*sizeof(T))));
   }
 
   template<typename T>
-  void host_to_le_arr(uint8_t* arr, int num_blocks) {
-    for(int i=0;i<num_blocks;++i)
+  void host_to_le_arr(uint8_t* arr, size_t num_blocks) {
+    for(size_t i=0;i<num_blocks;++i)
       host_to_le(*((T*)(arr+i*sizeof(T))));
   }
 
   template<typename T>
-  void host_to_be_arr(uint8_t* arr, int num_blocks) {
-    for(int i=0;i<num_blocks;++i)
+  void host_to_be_arr(uint8_t* arr, size_t num_blocks) {
+    for(size_t i=0;i<num_blocks;++i)
       host_to_be(*((T*)(arr+i*sizeof(T))));
   }
 }
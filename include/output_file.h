@@ -0,0 +1,51 @@
+#ifndef OUTPUT_FILE_H
+#define OUTPUT_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! an output that only appears under its name once it is complete: it is written to a
+//! temporary file in the same directory (unnamed with O_TMPFILE on Linux, hidden otherwise) and
+//! renamed into place by commit(), so a crash or an error never leaves a truncated file behind;
+//! on Linux the expected size is reserved up front with fallocate, which keeps the file
+//! contiguous instead of growing it block by block
+class output_file {
+public:
+  //! size_estimate may be 0 if unknown, a file growing past it just gets more space
+  output_file(const std::string& filename, uint64_t size_estimate);
+  output_file(const output_file& other) = delete;
+  //! removes the temporary file unless commit() succeeded
+  ~output_file();
+  //! appends size bytes
+  void write(const void* data, size_t size);
+  //! appends the chunks back to back, with one pwritev per IOV_MAX chunks on Linux
+  void write(const std::vector<std::vector<uint8_t>>& chunks);
+  //! overwrites already written bytes at offset, e.g. to fill in a header at the end
+  void write_at(const void* data, size_t size, uint64_t offset);
+  //! bytes appended so far
+  uint64_t size() const;
+  //! cuts off the unused preallocated space and flushes the file to storage (fsync)
+  void sync();
+  //! cuts off the unused preallocated space, closes the file and renames it to its final name
+  void commit();
+  //! flushes the entries of directory dirname ("" for the working directory), which makes a
+  //! committed rename durable
+  static void sync_directory(const std::string& dirname);
+private:
+  void close_file();
+
+  std::string filename_;
+  std::string tmp_filename_;
+  uint64_t size_;
+  bool committed_;
+#ifdef __linux__
+  // opened with O_TMPFILE, without a name until commit()
+  bool anonymous_;
+  int fd_;
+#else
+  void* file_;
+#endif
+};
+#endif
@@ -0,0 +1,30 @@
+#ifndef PCM_H
+#define PCM_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pcm {
+  //! frames converted per block, small enough for all channels of a block to stay in L1
+  const size_t block_frames=256;
+
+  //! G.711 A-law and u-law sample decoders, results are 16 bit linear
+  short alaw_sample(uint8_t in);
+  short ulaw_sample(uint8_t in);
+
+  //! decode num_samples G.711 bytes to 16 bit linear, through a table of the above
+  void decode_alaw(const uint8_t* src, short* dst, size_t num_samples);
+  void decode_ulaw(const uint8_t* src, short* dst, size_t num_samples);
+
+  //! converts num_frames interleaved little endian frames to planar float in [-1,1) times gain
+  //! format_code and block_sz as stored in wav_t, dst holds one pointer per channel
+  void to_float(const uint8_t* src, uint32_t format_code, unsigned block_sz, unsigned num_channels,
+                float* const* dst, size_t num_frames, float gain = 1.0f);
+
+  //! largest magnitude
+  float peak(const float* samples, size_t num_samples);
+
+  //! clamps samples to [-1,1]
+  void clip(float* samples, size_t num_samples);
+}
+#endif
@@ -0,0 +1,74 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include "pthread_raii.h"
+
+//! input prefetching: a few I/O threads read the next inputs into memory ahead of the encoder
+//! workers, so that a core never sits idle waiting for a read while there is work left
+namespace prefetch {
+  struct input {
+    std::string filename;
+    //! the complete file, empty if it wasn't read ahead
+    std::vector<uint8_t> data;
+    //! data holds the file; otherwise it was too large for the memory bound (or couldn't be
+    //! read) and the worker reads it itself, after the kernel was asked to read it ahead
+    bool loaded;
+  };
+
+  //! reads filenames in order with num_threads threads; at most depth inputs and max_bytes of
+  //! data wait for the workers at a time
+  class reader {
+  public:
+    reader(std::vector<std::string> filenames, unsigned num_threads, size_t depth, size_t max_bytes);
+    reader(const reader& other) = delete;
+    //! stops reading and joins the I/O threads
+    ~reader();
+    //! the next input that is ready, waiting for one if necessary; false once all inputs
+    //! have been handed out
+    bool next(input& in);
+    //! inputs not handed out yet
+    size_t remaining();
+  private:
+    void read_ahead();
+
+    const std::vector<std::string> filenames_;
+    const size_t depth_;
+    const size_t max_bytes_;
+    pthread_raii::pmutex m_;
+    pthread_raii::pcond ready_;
+    pthread_raii::pcond room_;
+    std::deque<input> queue_;
+    //! data held by queue_ and by the reads in progress
+    size_t queued_bytes_;
+    size_t reading_;
+    //! next filename to read and number of inputs handed out
+    size_t claimed_;
+    size_t handed_out_;
+    bool stopping_;
+    std::vector<pthread_raii::pthread> threads_;
+  };
+
+  //! counters of all readers, they show which side waits for the other
+  struct stats_t {
+    uint64_t loaded;
+    uint64_t bytes;
+    //! inputs only hinted to the kernel
+    uint64_t hinted;
+    //! mean number of ready inputs a worker found when it asked for one
+    double mean_depth;
+    //! workers finding no input ready: the I/O threads can't keep up (I/O bound)
+    uint64_t worker_waits;
+    double worker_wait_ms;
+    //! I/O threads finding the queue full: the workers can't keep up (CPU bound)
+    uint64_t reader_waits;
+    double reader_wait_ms;
+  };
+
+  stats_t stats();
+}
+#endif
@@ -2,8 +2,13 @@
 #define PTHREAD_RAII_H
 
 #include <pthread.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <ctime>
 #include <memory>
 #include <functional>
+#include <string>
 #include <utility>
 
 namespace pthread_raii {
@@ -18,6 +23,7 @@ namespace pthread_raii {
       pthread_mutex_destroy(&mutex_);
     }
     friend class plock_guard;
+    friend class pcond;
   private:
     pthread_mutex_t mutex_;
   };
@@ -35,13 +41,71 @@ namespace pthread_raii {
     pmutex& mutex;
   };
 
+  //! pthread condition variable wrapper, wait() expects the mutex to be held by a plock_guard
+  class pcond {
+  public:
+    pcond() {
+      pthread_cond_init(&cond_,nullptr);
+    }
+    pcond(pcond& other) = delete;
+    ~pcond() {
+      pthread_cond_destroy(&cond_);
+    }
+    void wait(pmutex& mutex) {
+      pthread_cond_wait(&cond_,&mutex.mutex_);
+    }
+    //! like wait(), but gives up after ms milliseconds, false on timeout
+    bool wait_for(pmutex& mutex, unsigned ms) {
+      timespec deadline;
+      clock_gettime(CLOCK_REALTIME,&deadline);
+      deadline.tv_sec+=ms/1000;
+      deadline.tv_nsec+=(long)(ms%1000)*1000000;
+      if(deadline.tv_nsec>=1000000000) {
+        ++deadline.tv_sec;
+        deadline.tv_nsec-=1000000000;
+      }
+      return pthread_cond_timedwait(&cond_,&mutex.mutex_,&deadline)==0;
+    }
+    void signal() {
+      pthread_cond_signal(&cond_);
+    }
+    void broadcast() {
+      pthread_cond_broadcast(&cond_);
+    }
+  private:
+    pthread_cond_t cond_;
+  };
+
+  //! optional attributes of a pthread
+  struct thread_options {
+    explicit thread_options(const std::string& name = std::string(), int cpu = -1) : name(name), cpu(cpu) {}
+    //! shown by top, perf and gdb, cut to 15 characters (Linux only)
+    std::string name;
+    //! CPU the thread is pinned to through its attributes, -1 for none (Linux only)
+    int cpu;
+  };
+
   class pthread {
   public:
     template<typename W>
-    explicit pthread(W w) : attr_(new pthread_attr_t), thread_(new pthread_t), work_(new std::function<void()>(w)) {
+    explicit pthread(W w) : pthread(thread_options(), w) {}
+    template<typename W>
+    pthread(const thread_options& options, W w) : attr_(new pthread_attr_t), thread_(new pthread_t), work_(new std::function<void()>(w)) {
       pthread_attr_init(attr_.get());
       pthread_attr_setdetachstate(attr_.get(), PTHREAD_CREATE_JOINABLE);
+#ifdef __linux__
+      if(options.cpu>=0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(options.cpu,&cpus);
+        pthread_attr_setaffinity_np(attr_.get(),sizeof(cpus),&cpus);
+      }
+#endif
       pthread_create(thread_.get(),attr_.get(),dispatch, (void*)this->work_.get());
+#ifdef __linux__
+      if(!options.name.empty())
+        pthread_setname_np(*thread_,options.name.substr(0,15).c_str());
+#endif
     }
     pthread(pthread&& other)=default;
     pthread(const pthread& other) = delete;
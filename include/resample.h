@@ -0,0 +1,30 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace resample {
+  enum class quality { low, medium, high };
+
+  //! parses "low", "medium" or "high"
+  quality parse_quality(const std::string& s);
+
+  //! polyphase windowed sinc resampler for a fixed ratio rate_out/rate_in
+  //! the filter bank holds one Kaiser windowed sinc per output phase
+  class resampler {
+  public:
+    resampler(unsigned rate_in, unsigned rate_out, quality q);
+    //! number of frames process() writes for num_in input frames
+    size_t output_frames(size_t num_in) const;
+    //! resamples one channel, samples outside of in count as silence
+    void process(const float* in, size_t num_in, float* out) const;
+  private:
+    unsigned up_;
+    unsigned down_;
+    unsigned taps_;
+    std::vector<float> bank_;
+  };
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "output_file.h"
+
+namespace segment {
+  //! size in bytes of the MPEG audio layer III frame starting with header, 0 if header isn't one
+  size_t frame_size(const uint8_t* header);
+
+  //! splits an mp3 stream into files of a fixed number of frames while it is being written
+  //! and lists them in an HLS playlist; segments are named name_00000.mp3, ... and the
+  //! playlist name.m3u8, which is rewritten after every finished segment; segments and
+  //! playlist only appear once complete (see output_file)
+  class writer {
+  public:
+    writer(const std::string& name, double segment_seconds, unsigned sample_rate, unsigned frame_samples);
+    //! written in front of the first segment, e.g. an ID3v2 tag
+    void prefix(const uint8_t* data, size_t size);
+    //! appends encoder output, segments are closed as soon as their last frame is complete
+    void write(const uint8_t* data, size_t size);
+    //! closes the last segment and writes the playlist
+    void finish();
+  private:
+    void open_segment(size_t frame_size);
+    void close_segment();
+    void write_playlist(bool complete);
+
+    std::string name_;
+    unsigned frames_per_segment_;
+    double frame_seconds_;
+    std::unique_ptr<output_file> file_;
+    unsigned frames_in_segment_;
+    std::vector<unsigned> segment_frames_;
+    std::vector<uint8_t> prefix_;
+    // incomplete frame left over from the last write
+    std::vector<uint8_t> pending_;
+  };
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <cstddef>
+#include <string>
+#include "convert.h"
+
+//! daemon mode: a worker_pool behind a Unix domain socket
+//! every message is a frame of a 4 byte little endian length and the payload
+//! request:  "<id>\n<input path>\n<output path>"
+//! response: "<id> OK <queued ms> <convert ms>", "<id> ERR <message>" or "<id> BUSY"
+//! BUSY means the queue was full and the job was not taken, the client has to resend it
+//! a connection may have any number of jobs in flight, responses arrive in completion order;
+//! the daemon stops reading requests while 256 responses wait for the client to read them
+namespace server {
+  //! larger frames are treated as a protocol error
+  const size_t max_frame=64*1024;
+
+  //! false at the end of the connection or on errors
+  bool read_frame(int fd, std::string& payload);
+  bool write_frame(int fd, const std::string& payload);
+
+  //! connects to the daemon listening on socket_path, returns the socket
+  int connect(const std::string& socket_path);
+
+  //! listens on socket_path and converts jobs with num_workers workers until SIGINT or SIGTERM,
+  //! at most queue_capacity jobs wait at a time
+  void serve(const std::string& socket_path, const convert::settings& s, unsigned num_workers,
+             size_t queue_capacity);
+}
+#endif
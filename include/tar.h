@@ -0,0 +1,67 @@
+#ifndef TAR_H
+#define TAR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include "convert.h"
+
+//! streaming ustar archives: members are read and written strictly in order, so neither
+//! stream has to be seekable (GNU long names, pax path/size records and base-256 sizes are
+//! understood when reading)
+namespace tar {
+  const size_t block_size=512;
+
+  struct member {
+    std::string name;
+    uint64_t size;
+    //! ustar type flag, '0' for regular files
+    char type;
+    unsigned mode;
+    uint64_t mtime;
+  };
+
+  class reader {
+  public:
+    explicit reader(std::istream& in);
+    //! header of the next member, false at the end of the archive
+    //! the data of the previous member is skipped if it wasn't read
+    bool next(member& m);
+    //! data of the current member
+    void read(std::vector<uint8_t>& data);
+  private:
+    bool read_block(char* block);
+    void skip(uint64_t size);
+
+    std::istream& in_;
+    // bytes of the current member not consumed yet, including the padding to the block size
+    uint64_t remaining_;
+    uint64_t size_;
+  };
+
+  class writer {
+  public:
+    explicit writer(std::ostream& out);
+    void add(const member& m, const uint8_t* data, size_t size);
+    //! writes the two zero blocks ending the archive
+    void finish();
+  private:
+    void header(const member& m, const std::string& name, const std::string& prefix, uint64_t size,
+                char type);
+    //! zeros up to the next block boundary after size bytes
+    void pad(uint64_t size);
+
+    std::ostream& out_;
+  };
+
+  //! converts the WAV members of the archive in to MP3 members of the archive out with
+  //! num_workers threads; at most window members are read ahead of the oldest one not yet
+  //! written, which bounds the memory held for reordering the output into input order
+  //! other members are dropped, failed members are reported to stderr and dropped
+  //! as for in-memory conversion bitrates, segment_seconds and loudness_sidecar are ignored
+  void convert(std::istream& in, std::ostream& out, const convert::settings& s, unsigned num_workers,
+               size_t window);
+}
+#endif
@@ -1,12 +1,35 @@
 #ifndef UTIL_H
 #define UTIL_H
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <functional>
+#include "pthread_raii.h"
 namespace util {
+  //! CPUs worth one worker each: the CPUs in the affinity mask, capped by the CPU quota (v2
+  //! cpu.max, v1 cpu.cfs_quota_us) of the process's cgroup or its ancestors rounded up (Linux),
+  //! the online CPUs elsewhere
   int num_cores();
+  //! CPUs the process may run on, from its affinity mask on Linux
+  std::vector<int> allowed_cpus();
+  //! pin the threads created with worker_thread() to distinct allowed CPUs
+  void set_pin_workers(bool pin);
+  //! options for worker index of a group of workers: named "<prefix>-<index>" and pinned
+  //! to an allowed CPU (round robin) if pinning is on
+  pthread_raii::thread_options worker_thread(const std::string& prefix, unsigned index);
+  //! memory available to the process: the smallest memory limit of its cgroup and their
+  //! ancestors if there is one (Linux), the physical memory otherwise
+  uint64_t memory_limit();
   void list_files(std::string dirname, std::vector<std::string>& filenames, std::function<bool(std::string)> predicate);
   extern char slash;
   std::string string_to_lower(std::string);
+  //! reads the whole file into data with one read if it holds at most limit bytes, false
+  //! (data left alone) for larger files and files that can't be opened
+  bool read_small_file(const std::string& filename, std::vector<uint8_t>& data, size_t limit);
+  //! size in bytes, 0 if it isn't a regular file
+  uint64_t file_size(const std::string& filename);
+  //! asks the kernel to read the file into the page cache in the background (Linux only)
+  void read_ahead(const std::string& filename);
 }
 #endif
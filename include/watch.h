@@ -0,0 +1,14 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <string>
+#include "worker_pool.h"
+
+namespace watch {
+  //! converts the WAV files in dirname, then every WAV file closed after writing or moved into it
+  //! until SIGINT or SIGTERM; events of a file are coalesced until it has been quiet for
+  //! debounce_ms, so files written in several passes are converted once; if the kernel's event
+  //! queue overflows, all WAV files in dirname are converted again; Linux only
+  void run(const std::string& dirname, worker_pool::pool& workers, unsigned debounce_ms);
+}
+#endif
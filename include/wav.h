@@ -1,9 +1,10 @@
 #ifndef WAV_H
 #define WAV_H
 
-#include <memory>
 #include <string>
 #include <cstdint>
+#include <iosfwd>
+#include "buffer_pool.h"
 
 namespace wav {
 
@@ -11,6 +12,9 @@ namespace wav {
   const uint32_t WAV_FORMAT_ID=*(uint32_t*)"WAVE";
   const uint32_t FMT_ID=*(uint32_t*)"fmt ";
   const uint32_t DATA_ID=*(uint32_t*)"data";
+  const uint32_t RF64_ID=*(uint32_t*)"RF64";
+  const uint32_t BW64_ID=*(uint32_t*)"BW64";
+  const uint32_t DS64_ID=*(uint32_t*)"ds64";
   const uint16_t WAVE_FORMAT_PCM=0x0001;
   const uint16_t WAVE_FORMAT_IEEE_FLOAT=0x0003;
   const uint16_t WAVE_FORMAT_ALAW=0x0006;
@@ -22,11 +26,30 @@ namespace wav {
     unsigned sample_rate;
     unsigned num_channels;
     uint32_t format_code;
-    std::unique_ptr<uint8_t[]> data;
-    unsigned num_samples;
+    //! speaker positions for WAVE_FORMAT_EXTENSIBLE, 0 otherwise
+    uint32_t channel_mask;
+    buffer_pool::buffer data;
+    uint64_t num_samples;
+    //! channels stored one after another instead of interleaved (only after decoding)
+    bool planar;
   };
 
-  void read_wav(std::string filename, wav_t& wav);
+  //! with a trim_threshold >= 0 (linear, full scale is 1) leading and trailing frames
+  //! without any sample above it are skipped and not read
+  void read_wav(std::string filename, wav_t& wav, float trim_threshold = -1);
+  //! same for a complete WAV file in a seekable stream
+  void read_wav(std::istream& file, wav_t& wav, float trim_threshold = -1);
+
+  //! returned by read_wav_header when the data size is a streaming placeholder (0 or 0xFFFFFFFF)
+  const uint64_t unknown_size=UINT64_MAX;
+
+  //! reads the headers of a WAV stream up to the first sample, fmt has to come before data
+  //! sets the format fields of wav and returns the size of the data chunk in bytes
+  uint64_t read_wav_header(std::istream& in, wav_t& wav);
+
+  //! reads up to num_frames frames from a stream positioned in the data chunk into wav.data
+  //! returns the number of frames read, which is less than num_frames only at the end
+  size_t read_wav_frames(std::istream& in, wav_t& wav, size_t num_frames);
   
 }
 #endif
@@ -0,0 +1,39 @@
+#ifndef WAV2MP3_H
+#define WAV2MP3_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "convert.h"
+
+//! entry points of libwav2mp3 for callers that hold the audio in memory or produce and consume
+//! it through callbacks; the library has to be linked together with libmp3lame and pthreads
+namespace wav2mp3 {
+  //! puts up to size bytes into buffer and returns how many, 0 at the end of the input
+  typedef std::function<size_t(uint8_t* buffer, size_t size)> read_callback;
+  //! consumes size bytes of MP3 data
+  typedef std::function<void(const uint8_t* data, size_t size)> write_callback;
+
+  //! converts with fixed settings, meant to be kept and reused for any number of conversions
+  //! a converter must not be used by several threads at once, errors are thrown as std::runtime_error
+  class converter {
+  public:
+    explicit converter(const convert::settings& s = convert::settings());
+    const convert::settings& settings() const;
+
+    //! complete WAV file in memory to a complete MP3, valid until the next call
+    //! bitrates, segment_seconds and loudness_sidecar don't apply to a single in-memory output
+    const std::vector<uint8_t>& convert(const uint8_t* wav, size_t size);
+    //! same, the finished MP3 (with its Xing/LAME tag filled in) is handed to out in one piece
+    void convert(const uint8_t* wav, size_t size, const write_callback& out);
+    //! streaming conversion as in convert::convert_stream, out gets the MP3 frames as they are
+    //! produced, the Xing/LAME tag frame stays empty
+    void convert(const read_callback& in, const write_callback& out);
+  private:
+    convert::settings settings_;
+    // keeps its capacity from one conversion to the next
+    std::vector<uint8_t> output_;
+  };
+}
+#endif
@@ -0,0 +1,59 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "convert.h"
+#include "pthread_raii.h"
+
+namespace worker_pool {
+  struct result {
+    bool ok;
+    //! exception message if the conversion failed
+    std::string error;
+    //! time spent waiting in the queue and converting
+    double queued_ms;
+    double convert_ms;
+  };
+
+  struct job {
+    std::string filename_in;
+    std::string filename_out;
+    //! called by the worker after the conversion, may be empty
+    std::function<void(const result&)> done;
+  };
+
+  //! persistent workers converting queued jobs; the workers and their buffer pools stay
+  //! warm for the lifetime of the pool
+  class pool {
+  public:
+    pool(const convert::settings& s, unsigned num_workers, size_t capacity);
+    pool(const pool& other) = delete;
+    //! finishes all queued jobs and joins the workers
+    ~pool();
+    //! queues j unless capacity jobs are already waiting
+    bool try_submit(job j);
+    //! queues j, waiting for room if necessary
+    void submit(job j);
+    size_t queued();
+  private:
+    struct entry;
+    uint64_t job_memory(const job& j) const;
+    //! index of the worker, workers outside the active set of the concurrency controller park
+    void work(unsigned index);
+
+    const convert::settings settings_;
+    const size_t capacity_;
+    pthread_raii::pmutex m_;
+    pthread_raii::pcond not_empty_;
+    pthread_raii::pcond not_full_;
+    std::deque<entry> queue_;
+    bool stopping_;
+    std::vector<pthread_raii::pthread> threads_;
+  };
+}
+#endif
@@ -0,0 +1,52 @@
+#ifndef WRITE_BEHIND_H
+#define WRITE_BEHIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! write-behind stage: workers hand finished outputs to a writer thread instead of waiting
+//! for the storage, the writer drains the queue in batches and writes every output with
+//! pwritev into a preallocated temporary file (see output_file)
+namespace write_behind {
+  //! none: no fsync, file: fsync every output before it is renamed into place,
+  //! batch: write a whole batch, then fsync its files and publish them together
+  enum class durability { none, file, batch };
+
+  //! parses "none", "file" or "batch"
+  durability parse_durability(const std::string& s);
+
+  //! an output as a list of chunks written back to back
+  typedef std::vector<std::vector<uint8_t>> chunks;
+
+  //! starts the writer thread; at most max_bytes of outputs wait to be written
+  void start(size_t max_bytes, durability d);
+
+  //! writes everything still queued and stops the writer thread
+  void stop();
+
+  bool running();
+
+  //! queues data for filename, waits while max_bytes are already in flight
+  //! write errors are reported to stderr by the writer thread
+  void submit(const std::string& filename, chunks data);
+
+  //! an empty buffer with the capacity of an output that has been written, or a new one;
+  //! lets a worker that hands its output over keep filling the same few buffers
+  std::vector<uint8_t> spare();
+
+  struct stats_t {
+    uint64_t files;
+    uint64_t bytes;
+    //! outputs that couldn't be written or published
+    uint64_t failed;
+    uint64_t batches;
+    uint64_t fsyncs;
+    //! time workers spent in submit waiting for room
+    double wait_ms;
+  };
+
+  stats_t stats();
+}
+#endif
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include "backlog.h"
+#include "concurrency.h"
+#include "pthread_raii.h"
+
+namespace {
+  using namespace pthread_raii;
+
+  // time of a job at each quality relative to quality 2, measured with LAME 3.100 on
+  // 20 s of 44.1 kHz stereo at 128 kbps; 3 and 4 are the same speed, as are 5 and 6
+  // and 7 to 9, and only the best quality of such a group is used
+  const double relative_time[backlog::num_qualities]={3.03,1.42,1.0,0.47,0.47,0.43,0.43,0.25,0.25,0.25};
+  // weight of the latest job in the running mean of the job cost
+  const double cost_weight=0.1;
+
+  pmutex m;
+  double drain_target=0;
+  unsigned workers=1;
+  // mean time of a job at quality 2, 0 until a job has finished
+  double cost=0;
+  uint64_t jobs[backlog::num_qualities];
+  uint64_t degraded=0;
+
+  int clamp_quality(int q) {
+    return std::min(backlog::num_qualities-1,std::max(0,q));
+  }
+}
+
+namespace backlog {
+
+  void set_target(double seconds, unsigned num_workers) {
+    plock_guard g(m);
+    drain_target=std::max(0.0,seconds);
+    workers=std::max(1u,num_workers);
+  }
+
+  double target() {
+    plock_guard g(m);
+    return drain_target;
+  }
+
+  int quality(size_t queued, int normal) {
+    normal=clamp_quality(normal);
+    // the adaptive controller changes the number of workers taking jobs
+    unsigned n=concurrency::running() ? concurrency::stats().active : 0;
+    plock_guard g(m);
+    if(drain_target<=0 || cost==0)
+      return normal;
+    // this job and the queue behind it spread over the workers
+    double drain=(queued+1)*cost/(n ? n : workers);
+    int q=normal;
+    while(drain*relative_time[q]>drain_target) {
+      // the next quality that is actually faster, if there is one
+      int next=q+1;
+      while(next<num_qualities && relative_time[next]>=relative_time[q])
+        ++next;
+      if(next==num_qualities)
+        break;
+      q=next;
+    }
+    if(q!=normal)
+      ++degraded;
+    return q;
+  }
+
+  void record(double seconds, int q) {
+    q=clamp_quality(q);
+    plock_guard g(m);
+    ++jobs[q];
+    double c=seconds/relative_time[q];
+    cost=cost==0 ? c : cost+cost_weight*(c-cost);
+  }
+
+  stats_t stats() {
+    plock_guard g(m);
+    stats_t s;
+    std::copy(jobs,jobs+num_qualities,s.jobs);
+    s.degraded=degraded;
+    return s;
+  }
+}
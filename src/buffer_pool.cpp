@@ -0,0 +1,136 @@
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "buffer_pool.h"
+
+namespace {
+  using std::atomic;
+  using std::vector;
+
+  // smallest size class, everything below is rounded up to this
+  const int min_shift=12;
+  const size_t min_size=size_t(1)<<min_shift;
+  // every power of two is split into 4 classes, so at most 25% is wasted
+  const int steps_per_octave=4;
+  const size_t huge_page_size=size_t(2)<<20;
+
+  atomic<uint64_t> bytes_reused(0);
+  atomic<uint64_t> bytes_allocated(0);
+  atomic<uint64_t> num_reused(0);
+  atomic<uint64_t> num_allocated(0);
+  atomic<bool> huge_pages(false);
+  atomic<size_t> max_cached(size_t(256)<<20);
+
+  // maps a requested size to its class index and the capacity of that class
+  size_t size_class(size_t size, size_t& capacity) {
+    if(size<=min_size) {
+      capacity=min_size;
+      return 0;
+    }
+    int e=min_shift;
+    while((size_t(1)<<(e+1))<size)
+      ++e;
+    size_t base=size_t(1)<<e;
+    size_t step=base/steps_per_octave;
+    size_t k=(size-base+step-1)/step;
+    capacity=base+k*step;
+    return (e-min_shift)*steps_per_octave+k;
+  }
+
+  uint8_t* allocate(size_t capacity) {
+    void* p=nullptr;
+#ifdef __linux__
+    if(huge_pages.load(std::memory_order_relaxed) && capacity>=huge_page_size) {
+      if(posix_memalign(&p,huge_page_size,capacity)!=0)
+        throw std::bad_alloc();
+      madvise(p,capacity,MADV_HUGEPAGE);
+      return (uint8_t*)p;
+    }
+#endif
+    p=std::malloc(capacity);
+    if(!p)
+      throw std::bad_alloc();
+    return (uint8_t*)p;
+  }
+
+  struct pool {
+    vector<vector<uint8_t*>> free_lists;
+    size_t cached=0;
+    ~pool() {
+      for(auto& l:free_lists)
+        for(uint8_t* p:l)
+          std::free(p);
+    }
+  };
+
+  pool& local_pool() {
+    thread_local pool p;
+    return p;
+  }
+}
+
+namespace buffer_pool {
+
+  buffer::buffer(size_t size) {
+    size_t cls=size_class(size,capacity_);
+    pool& p=local_pool();
+    if(cls<p.free_lists.size() && !p.free_lists[cls].empty()) {
+      data_=p.free_lists[cls].back();
+      p.free_lists[cls].pop_back();
+      p.cached-=capacity_;
+      bytes_reused.fetch_add(capacity_,std::memory_order_relaxed);
+      num_reused.fetch_add(1,std::memory_order_relaxed);
+    }
+    else {
+      data_=allocate(capacity_);
+      bytes_allocated.fetch_add(capacity_,std::memory_order_relaxed);
+      num_allocated.fetch_add(1,std::memory_order_relaxed);
+    }
+  }
+
+  buffer& buffer::operator=(buffer&& other) {
+    if(this!=&other) {
+      reset();
+      data_=other.data_;
+      capacity_=other.capacity_;
+      other.data_=nullptr;
+      other.capacity_=0;
+    }
+    return *this;
+  }
+
+  void buffer::reset() {
+    if(!data_)
+      return;
+    pool& p=local_pool();
+    if(p.cached+capacity_<=max_cached.load(std::memory_order_relaxed)) {
+      size_t capacity;
+      size_t cls=size_class(capacity_,capacity);
+      if(cls>=p.free_lists.size())
+        p.free_lists.resize(cls+1);
+      p.free_lists[cls].push_back(data_);
+      p.cached+=capacity_;
+    }
+    else
+      std::free(data_);
+    data_=nullptr;
+    capacity_=0;
+  }
+
+  stats_t stats() {
+    return stats_t{bytes_reused.load(),bytes_allocated.load(),num_reused.load(),num_allocated.load()};
+  }
+
+  void set_huge_pages(bool enable) {
+    huge_pages=enable;
+  }
+
+  void set_max_cached(size_t bytes) {
+    max_cached=bytes;
+  }
+}
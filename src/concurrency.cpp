@@ -0,0 +1,247 @@
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include "concurrency.h"
+#include "pthread_raii.h"
+
+namespace {
+  using namespace pthread_raii;
+  using std::string;
+  using clock = std::chrono::steady_clock;
+
+  // changes of throughput within this fraction count as noise
+  const double tolerance=0.05;
+  // a probe adds a worker when the workers are blocked this much of their time and
+  // removes one when they wait this much of their time for a CPU
+  const double io_wait_high=0.2;
+  const double cpu_wait_high=0.25;
+  // windows without probing after a step was undone
+  const unsigned hold_windows=3;
+
+  pmutex m;
+  pcond admitted;
+  pcond stopped;
+  concurrency::settings config;
+  std::function<void(const string&)> log;
+  unsigned active=0;
+  bool started=false;
+  bool draining=false;
+  std::unique_ptr<pthread> controller_thread;
+
+  // the current window, guarded by m
+  double audio=0;
+  double busy=0;
+  double cpu=0;
+  double runnable=0;
+
+  uint64_t decisions=0;
+  uint64_t changes=0;
+  unsigned fewest=0;
+  unsigned most=0;
+
+  double seconds(clock::time_point t) {
+    return std::chrono::duration<double>(t.time_since_epoch()).count();
+  }
+
+  // CPU time of the calling thread and the time it spent runnable but waiting for a CPU
+  void thread_times(double& cpu_seconds, double& runnable_seconds) {
+#ifdef __linux__
+    // "<on cpu ns> <on run queue ns> <time slices>"
+    int fd=open("/proc/thread-self/schedstat",O_RDONLY);
+    if(fd>=0) {
+      char buf[128];
+      ssize_t n=read(fd,buf,sizeof(buf)-1);
+      close(fd);
+      if(n>0) {
+        buf[n]='\0';
+        char* end;
+        cpu_seconds=std::strtoull(buf,&end,10)/1e9;
+        runnable_seconds=std::strtoull(end,nullptr,10)/1e9;
+        return;
+      }
+    }
+#endif
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+    cpu_seconds=ts.tv_sec+ts.tv_nsec/1e9;
+    runnable_seconds=0;
+  }
+
+  // needs m to be held
+  void set_active(unsigned n) {
+    if(n>active)
+      admitted.broadcast();
+    active=n;
+    fewest=std::min(fewest,n);
+    most=std::max(most,n);
+  }
+
+  string percent(double fraction) {
+    char buf[16];
+    snprintf(buf,sizeof(buf),"%.0f%%",100*fraction);
+    return buf;
+  }
+
+  void control() {
+    // throughput of the previous window, and the step taken after it if that was an
+    // experiment whose outcome the next window judges
+    double previous=0;
+    int last_step=0;
+    unsigned hold=0;
+    plock_guard g(m);
+    auto window_start=clock::now();
+    while(started) {
+      auto deadline=window_start+std::chrono::duration<double>(config.window_seconds);
+      while(started && clock::now()<deadline)
+        stopped.wait_for(m,(unsigned)std::max<long long>(1,std::chrono::duration_cast<std::chrono::milliseconds>(deadline-clock::now()).count()));
+      if(!started)
+        break;
+      double elapsed=std::chrono::duration<double>(clock::now()-window_start).count();
+      double throughput=audio/elapsed;
+      double io_wait=busy>0 ? std::max(0.0,busy-cpu-runnable)/busy : 0;
+      double cpu_wait=busy>0 ? runnable/busy : 0;
+
+      int step=0;
+      bool undo=false;
+      string reason;
+      if(audio==0)
+        // jobs longer than the window, or no work: nothing to judge the last step by
+        reason="no job finished";
+      else if(last_step!=0 && throughput>previous*(1+tolerance)) {
+        step=last_step;
+        reason="throughput rose, continuing";
+      }
+      else if(last_step>0 || (last_step<0 && throughput<previous*(1-tolerance))) {
+        // an added worker has to pay for itself, a removed one must not cost throughput
+        step=-last_step;
+        undo=true;
+        hold=hold_windows;
+        reason=last_step>0 ? "no gain from the added worker, undoing" : "throughput fell, undoing";
+      }
+      else if(hold>0) {
+        --hold;
+        reason="holding";
+      }
+      else if(io_wait>io_wait_high && cpu_wait<=cpu_wait_high) {
+        // more workers only hide I/O latency if there are CPUs left to run them
+        step=1;
+        reason="workers blocked on I/O, probing with one more";
+      }
+      else if(cpu_wait>cpu_wait_high) {
+        step=-1;
+        reason="workers waiting for a CPU, probing with one less";
+      }
+      else
+        reason="steady";
+
+      unsigned before=active;
+      unsigned after=(unsigned)std::min<int>(config.max_workers,std::max<int>(config.min_workers,(int)active+step));
+      if(step!=0 && after==before)
+        reason+=" (at bound)";
+      // only probes and continued steps are judged by the next window, undoing is not; a
+      // window without finished jobs leaves the judgement to the next one
+      if(audio>0) {
+        last_step=undo ? 0 : (int)after-(int)before;
+        previous=throughput;
+      }
+      ++decisions;
+      if(after!=before) {
+        ++changes;
+        set_active(after);
+      }
+
+      char line[256];
+      snprintf(line,sizeof(line),"concurrency: %u -> %u workers, %.1f audio s/s, %s blocked on I/O, %s waiting for a CPU: ",
+               before,after,throughput,percent(io_wait).c_str(),percent(cpu_wait).c_str());
+      if(log)
+        log(line+reason);
+
+      audio=busy=cpu=runnable=0;
+      window_start=clock::now();
+    }
+  }
+}
+
+namespace concurrency {
+
+  void start(const settings& s, std::function<void(const string&)> log_line) {
+    {
+      plock_guard g(m);
+      config=s;
+      config.min_workers=std::max(1u,s.min_workers);
+      config.max_workers=std::max(config.min_workers,s.max_workers);
+      config.window_seconds=std::max(0.1,s.window_seconds);
+      log=log_line;
+      started=true;
+      draining=false;
+      fewest=most=active=std::min(config.max_workers,std::max(config.min_workers,s.initial_workers));
+      audio=busy=cpu=runnable=0;
+    }
+    controller_thread.reset(new pthread(thread_options("concurrency"),control));
+  }
+
+  void stop() {
+    {
+      plock_guard g(m);
+      started=false;
+      stopped.broadcast();
+      admitted.broadcast();
+    }
+    controller_thread.reset();
+  }
+
+  bool running() {
+    plock_guard g(m);
+    return started;
+  }
+
+  void admit(unsigned index) {
+    plock_guard g(m);
+    while(started && !draining && index>=active)
+      admitted.wait(m);
+  }
+
+  void drain() {
+    plock_guard g(m);
+    draining=true;
+    admitted.broadcast();
+  }
+
+  job_timer::job_timer() {
+    {
+      plock_guard g(m);
+      measuring_=started;
+    }
+    if(!measuring_)
+      return;
+    thread_times(cpu_,runnable_);
+    wall_=seconds(clock::now());
+  }
+
+  void job_timer::finish(double audio_seconds) {
+    if(!measuring_)
+      return;
+    double c, r;
+    thread_times(c,r);
+    double w=seconds(clock::now());
+    plock_guard g(m);
+    if(!started)
+      return;
+    audio+=audio_seconds;
+    busy+=w-wall_;
+    cpu+=c-cpu_;
+    runnable+=r-runnable_;
+  }
+
+  stats_t stats() {
+    plock_guard g(m);
+    return stats_t{decisions,changes,active,fewest,most};
+  }
+}
@@ -1,45 +1,71 @@
+#include "buffer_pool.h"
+#include "convert.h"
+#include "downmix.h"
+#include "encoder_pool.h"
 #include "lame.h"
+#include "loudness.h"
+#include "memory_buf.h"
 #include "memory_layout.h"
+#include "output_file.h"
+#include "pcm.h"
+#include "pthread_raii.h"
+#include "resample.h"
+#include "segment.h"
+#include "util.h"
 #include "wav.h"
+#include "write_behind.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <fstream>
 #include <limits>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
-using std::fclose;
-using std::FILE;
-using std::fopen;
 using std::numeric_limits;
-using std::ofstream;
 using std::runtime_error;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 
+using buffer_pool::buffer;
 using namespace wav;
 
+// input frames per encoder call, keeps LAME's int sizes and the mp3 buffer
+// small for any input length
+const size_t encode_chunk_frames = 16384;
+const int chunk_mp3buffer_size = (encode_chunk_frames * 5) / 4 + 7200;
+// input frames per read in stream mode, one MPEG-1 layer III frame
+const size_t stream_block_frames = 1152;
+// inputs up to this size are read with a single read and converted in memory,
+// about 3 s of 48 kHz 24 bit stereo
+const size_t small_file_limit = 1 << 20;
+// per output LAME context and mp3 buffer, for memory estimates
+const uint64_t encoder_overhead = 1 << 20;
+
 void center_unsigned_pcm(wav_t &wav) {
-  int samples_total = wav.num_samples * wav.num_channels;
+  size_t samples_total = wav.num_samples * wav.num_channels;
   int8_t *buf = (int8_t *)wav.data.get();
   uint8_t *ubuf = wav.data.get();
-  for (int i = 0; i < samples_total; ++i)
+  for (size_t i = 0; i < samples_total; ++i)
     buf[i] = (ubuf[i] - (1 << 7));
 }
 
 void pad_pcm(wav_t &wav) {
   int block_sz_in = wav.block_sz;
   int block_sz_out = wav.block_sz < sizeof(short) ? sizeof(short) : sizeof(int);
-  int num_blocks = wav.num_samples * wav.num_channels;
-  unique_ptr<uint8_t[]> input(std::move(wav.data));
-  wav.data.reset(new uint8_t[num_blocks * block_sz_out]);
+  size_t num_blocks = wav.num_samples * wav.num_channels;
+  buffer input(std::move(wav.data));
+  wav.data = buffer(num_blocks * block_sz_out);
   memory_layout::pad_le(wav.data.get(), input.get(), block_sz_in, block_sz_out,
                         num_blocks);
   wav.block_sz = block_sz_out;
 }
 
 void host_align_data(wav_t &wav) {
-  int num_blocks = wav.num_samples * wav.num_channels;
+  size_t num_blocks = wav.num_samples * wav.num_channels;
   if (wav.block_sz == 1)
     return;
   else if (wav.block_sz == 2)
@@ -50,45 +76,22 @@ void host_align_data(wav_t &wav) {
     memory_layout::le_to_host_arr<uint64_t>(wav.data.get(), num_blocks);
 }
 
-// https://en.wikipedia.org/wiki/G.711#A-Law
 void decode_alaw(wav_t &wav) {
   int block_out = sizeof(short);
-  int samples_total = wav.num_samples * wav.num_channels;
-  unique_ptr<uint8_t[]> input(std::move(wav.data));
-  wav.data.reset(new uint8_t[samples_total * block_out]);
-  for (int i = 0; i < samples_total; ++i) {
-    uint8_t *out = wav.data.get() + i * block_out;
-    uint8_t *in = input.get() + i;
-    short ix = (short)*in ^ (0x0055); // invert even bits
-    short mantissa = ix & 0x000F;
-    short exponent = (ix >> 4) & ~(1 << 3);
-    mantissa += (exponent > 0) ? (1 << 4) : 0;
-    mantissa = (mantissa << 4) + (0x0008);
-    mantissa = (exponent > 0) ? mantissa << (exponent - 1) : mantissa;
-    short sgn = 1 - 2 * (!!(ix & (1 << 7)));
-    *(short *)out = sgn * mantissa;
-  }
+  size_t samples_total = wav.num_samples * wav.num_channels;
+  buffer input(std::move(wav.data));
+  wav.data = buffer(samples_total * block_out);
+  pcm::decode_alaw(input.get(), (short *)wav.data.get(), samples_total);
   wav.block_sz = block_out;
   wav.format_code = WAVE_FORMAT_PCM;
 }
 
-// https://en.wikipedia.org/wiki/G.711#%CE%BC-Law
 void decode_ulaw(wav_t &wav) {
   int block_out = sizeof(short);
-  int samples_total = wav.num_samples * wav.num_channels;
-  unique_ptr<uint8_t[]> input(std::move(wav.data));
-  wav.data.reset(new uint8_t[samples_total * block_out]);
-  for (int i = 0; i < samples_total; ++i) {
-    uint8_t *out = wav.data.get() + i * block_out;
-    uint8_t *in = input.get() + i;
-    short ix = (short)(*in ^ 0xFF); // invert all bits
-    short mantissa = ix & 0x000F;
-    short exponent = (ix >> 4) & ~(1 << 3);
-    short sgn = 1 - 2 * ((ix & (1 << 7)) != 0);
-    mantissa <<= (exponent + 1);
-    *(short *)out =
-        sgn * ((mantissa + (33 << exponent) - 33) << (block_out * 8 - 14));
-  }
+  size_t samples_total = wav.num_samples * wav.num_channels;
+  buffer input(std::move(wav.data));
+  wav.data = buffer(samples_total * block_out);
+  pcm::decode_ulaw(input.get(), (short *)wav.data.get(), samples_total);
   wav.block_sz = block_out;
   wav.format_code = WAVE_FORMAT_PCM;
 }
@@ -115,8 +118,118 @@ void check_support(const wav_t &wav) {
     throw runtime_error("Unsupported format");
 }
 
-void decode(wav_t &wav) {
+// decode straight to planar float, apply gain and, if m is set, mix in the
+// same pass, block by block; meter sees each block while it's still in cache
+void decode_planar(wav_t &wav, const downmix::matrix *m, float gain,
+                   loudness::meter *meter) {
+  size_t num_frames = wav.num_samples;
+  size_t frame_sz = wav.block_sz * wav.num_channels;
+  unsigned out_channels = m ? m->out_channels : wav.num_channels;
+  buffer output(num_frames * out_channels * sizeof(float));
+  buffer scratch;
+  if (m)
+    scratch = buffer(pcm::block_frames * wav.num_channels * sizeof(float));
+  std::vector<float *> in(wav.num_channels);
+  std::vector<float *> out(out_channels);
+  for (size_t i = 0; i < num_frames; i += pcm::block_frames) {
+    size_t n = std::min(pcm::block_frames, num_frames - i);
+    for (unsigned c = 0; c < out_channels; ++c)
+      out[c] = (float *)output.get() + c * num_frames + i;
+    for (unsigned c = 0; c < wav.num_channels; ++c)
+      in[c] = m ? (float *)scratch.get() + c * pcm::block_frames : out[c];
+    pcm::to_float(wav.data.get() + i * frame_sz, wav.format_code, wav.block_sz,
+                  wav.num_channels, in.data(), n, gain);
+    if (m)
+      downmix::mix(*m, in.data(), out.data(), n);
+    if (gain != 1.0f)
+      for (unsigned c = 0; c < out_channels; ++c)
+        pcm::clip(out[c], n);
+    if (meter)
+      meter->process(out.data(), n);
+  }
+  wav.data = std::move(output);
+  wav.format_code = WAVE_FORMAT_IEEE_FLOAT;
+  wav.block_sz = sizeof(float);
+  wav.num_channels = out_channels;
+  wav.planar = true;
+}
+
+// the filter bank is only rebuilt when the ratio or quality changes
+const resample::resampler &cached_resampler(unsigned rate_in,
+                                            unsigned rate_out,
+                                            resample::quality q) {
+  struct entry {
+    unsigned rate_in, rate_out;
+    resample::quality q;
+    unique_ptr<resample::resampler> r;
+  };
+  thread_local entry cached{0, 0, q, nullptr};
+  if (!cached.r || cached.rate_in != rate_in || cached.rate_out != rate_out ||
+      cached.q != q) {
+    cached.r.reset(new resample::resampler(rate_in, rate_out, q));
+    cached.rate_in = rate_in;
+    cached.rate_out = rate_out;
+    cached.q = q;
+  }
+  return *cached.r;
+}
+
+// expects planar data
+void resample_planar(wav_t &wav, unsigned rate_out, resample::quality q) {
+  const resample::resampler &r =
+      cached_resampler(wav.sample_rate, rate_out, q);
+  size_t num_in = wav.num_samples;
+  size_t num_out = r.output_frames(num_in);
+  buffer output(num_out * wav.num_channels * sizeof(float));
+  for (unsigned c = 0; c < wav.num_channels; ++c)
+    r.process((const float *)wav.data.get() + c * num_in, num_in,
+              (float *)output.get() + c * num_out);
+  wav.data = std::move(output);
+  wav.num_samples = num_out;
+  wav.sample_rate = rate_out;
+}
+
+// matrix to downmix with, nullptr if the channels can be encoded as they are
+const downmix::matrix *downmix_matrix(const wav_t &wav,
+                                      const convert::settings &s,
+                                      downmix::matrix &standard) {
+  for (const downmix::matrix &m : s.downmix_matrices)
+    if (m.in_channels == wav.num_channels)
+      return &m;
+  if (wav.num_channels <= 2)
+    return nullptr;
+  standard = downmix::standard(wav.num_channels, wav.channel_mask);
+  return &standard;
+}
+
+// formats LAME deinterleaves and converts again internally, mono input is
+// already planar and stays on the direct path
+bool planar_fast_path(const wav_t &wav) {
+  return wav.num_channels == 2 &&
+         (wav.format_code == WAVE_FORMAT_IEEE_FLOAT ||
+          (wav.format_code == WAVE_FORMAT_PCM && wav.block_sz == sizeof(int)));
+}
+
+// fills analysis if it isn't nullptr
+void decode(wav_t &wav, const convert::settings &s,
+            loudness::result *analysis) {
   check_support(wav);
+  downmix::matrix standard;
+  const downmix::matrix *m = downmix_matrix(wav, s, standard);
+  bool resample = s.out_sample_rate && s.out_sample_rate != wav.sample_rate;
+  if (m || resample || s.gain != 1.0f || analysis ||
+      (s.planar_float && planar_fast_path(wav))) {
+    unique_ptr<loudness::meter> meter;
+    if (analysis)
+      meter.reset(new loudness::meter(wav.sample_rate,
+                                      m ? m->out_channels : wav.num_channels));
+    decode_planar(wav, m, s.gain, meter.get());
+    if (analysis)
+      *analysis = meter->finish();
+    if (resample)
+      resample_planar(wav, s.out_sample_rate, s.resample_quality);
+    return;
+  }
   if (wav.format_code == WAVE_FORMAT_PCM && wav.block_sz != sizeof(short) &&
       wav.block_sz != sizeof(int)) {
     // 8 bit means unsigned
@@ -134,39 +247,57 @@ void decode(wav_t &wav) {
     host_align_data(wav);
 }
 
-// set lame flags in accordance with fmt
-void set_lgf(lame_global_flags *lgf, const wav_t &wav) {
-  lame_set_num_channels(lgf, wav.num_channels);
-  lame_set_in_samplerate(lgf, wav.sample_rate);
-  lame_set_mode(lgf, wav.num_channels == 1 ? MPEG_mode::MONO
-                                           : MPEG_mode::JOINT_STEREO);
+// encoder settings in accordance with fmt, out_sample_rate 0 leaves the MP3
+// rate to LAME
+encoder_pool::settings encoder_settings(const wav_t &wav, unsigned bitrate,
+                                        bool segmented, int quality,
+                                        unsigned out_sample_rate) {
+  encoder_pool::settings s;
+  s.sample_rate = wav.sample_rate;
+  s.out_sample_rate = out_sample_rate;
+  s.num_channels = wav.num_channels;
+  s.mode = wav.num_channels == 1 ? MPEG_mode::MONO : MPEG_mode::JOINT_STEREO;
 
-  // sane defaults for the rest
-  lame_set_brate(lgf, 128);
-  lame_set_quality(lgf, 2);
-  // lame_set_bWriteVbrTag(lgf,0);
-  if (lame_init_params(lgf) < 0)
-    throw runtime_error("Initialization of lame flags failed");
+  s.bitrate = bitrate;
+  s.segmented = segmented;
+  s.quality = quality;
+  return s;
 }
 
-namespace convert {
-
-void convert(string filename_in, string filename_out) {
-  wav_t wav;
-  read_wav(filename_in, wav);
-  decode(wav);
-
-  if (wav.num_channels < 1 || wav.num_channels > 2)
-    throw runtime_error("Unsupported number of channels");
-
-  // raii wrapper for lame flags
-  unique_ptr<lame_global_flags, decltype(&lame_close)> lgf(lame_init(),
-                                                           &lame_close);
-  set_lgf(lgf.get(), wav);
-
-  int mp3buffer_size = (wav.num_samples * 5) / 4 + 7200;
-  unique_ptr<uint8_t[]> mp3buffer(new uint8_t[mp3buffer_size]);
+// ID3v2 tag written in front of the audio: ReplayGain if analysis isn't
+// nullptr and the LAME quality if the settings ask for it, empty otherwise
+size_t id3_tag(lame_global_flags *lgf, const convert::settings &s,
+               const loudness::result *analysis, buffer &tag) {
+  if (!analysis && !s.quality_tag)
+    return 0;
+  char field[64];
+  id3tag_v2_only(lgf);
+  id3tag_add_v2(lgf);
+  if (analysis) {
+    const loudness::result &r = *analysis;
+    if (!std::isinf(r.integrated)) {
+      snprintf(field, sizeof(field), "TXXX=REPLAYGAIN_TRACK_GAIN=%.2f dB",
+               loudness::replaygain(r));
+      id3tag_set_fieldvalue(lgf, field);
+    }
+    snprintf(field, sizeof(field), "TXXX=REPLAYGAIN_TRACK_PEAK=%.6f",
+             r.true_peak);
+    id3tag_set_fieldvalue(lgf, field);
+  }
+  if (s.quality_tag) {
+    snprintf(field, sizeof(field), "TXXX=LAME_QUALITY=%d", s.quality);
+    id3tag_set_fieldvalue(lgf, field);
+  }
+  size_t size = lame_get_id3v2_tag(lgf, nullptr, 0);
+  tag = buffer(size);
+  return lame_get_id3v2_tag(lgf, tag.get(), size);
+}
 
+// encodes num_frames frames of the decoded samples starting at first
+int encode_frames(lame_global_flags *lgf, const wav_t &wav, uint64_t first,
+                  size_t num_frames, uint8_t *mp3buffer, int mp3buffer_size) {
+  const uint8_t *data =
+      wav.data.get() + first * wav.block_sz * (wav.planar ? 1 : wav.num_channels);
   int bytes_written = -1;
 
   // case 1: PCM integer data
@@ -174,64 +305,500 @@ void convert(string filename_in, string filename_out) {
       wav.format_code == WAVE_FORMAT_ALAW) {
     if (wav.num_channels == 1) {
       if (wav.block_sz == sizeof(short))
-        bytes_written = lame_encode_buffer(
-            lgf.get(), (const short *)wav.data.get(), nullptr, wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+        bytes_written =
+            lame_encode_buffer(lgf, (const short *)data, nullptr, num_frames,
+                               mp3buffer, mp3buffer_size);
       else if (wav.block_sz == sizeof(int))
-        bytes_written = lame_encode_buffer_int(
-            lgf.get(), (const int *)wav.data.get(), nullptr, wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+        bytes_written =
+            lame_encode_buffer_int(lgf, (const int *)data, nullptr, num_frames,
+                                   mp3buffer, mp3buffer_size);
     } else {
       if (wav.block_sz == sizeof(short))
         bytes_written = lame_encode_buffer_interleaved(
-            lgf.get(), (short *)wav.data.get(), wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (short *)data, num_frames, mp3buffer, mp3buffer_size);
       else if (wav.block_sz == sizeof(int))
         bytes_written = lame_encode_buffer_interleaved_int(
-            lgf.get(), (const int *)wav.data.get(), wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (const int *)data, num_frames, mp3buffer, mp3buffer_size);
     }
   }
-  // case 2: PCM IEEE float data
+  // case 2: planar float data
+  else if (wav.planar) {
+    const float *left = (const float *)data;
+    bytes_written = lame_encode_buffer_ieee_float(
+        lgf, left, wav.num_channels == 1 ? nullptr : left + wav.num_samples,
+        num_frames, mp3buffer, mp3buffer_size);
+  }
+  // case 3: PCM IEEE float data
   else if (wav.format_code == WAVE_FORMAT_IEEE_FLOAT) {
     if (wav.num_channels == 1) {
       if (wav.block_sz == sizeof(float))
         bytes_written = lame_encode_buffer_ieee_float(
-            lgf.get(), (const float *)wav.data.get(), nullptr, wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (const float *)data, nullptr, num_frames, mp3buffer,
+            mp3buffer_size);
       else if (wav.block_sz == sizeof(double))
         bytes_written = lame_encode_buffer_ieee_double(
-            lgf.get(), (const double *)wav.data.get(), nullptr, wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (const double *)data, nullptr, num_frames, mp3buffer,
+            mp3buffer_size);
     } else {
       if (wav.block_sz == sizeof(float))
         bytes_written = lame_encode_buffer_interleaved_ieee_float(
-            lgf.get(), (const float *)wav.data.get(), wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (const float *)data, num_frames, mp3buffer, mp3buffer_size);
       else if (wav.block_sz == sizeof(double))
         bytes_written = lame_encode_buffer_interleaved_ieee_double(
-            lgf.get(), (const double *)wav.data.get(), wav.num_samples,
-            mp3buffer.get(), mp3buffer_size);
+            lgf, (const double *)data, num_frames, mp3buffer, mp3buffer_size);
     }
   }
 
   if (bytes_written < 0)
     throw runtime_error("Conversion didn't work");
+  return bytes_written;
+}
+
+// encodes all samples in steps of encode_chunk_frames and flushes, write gets
+// the output of every step right away
+template <typename W>
+void encode_all(lame_global_flags *lgf, const wav_t &wav, buffer &mp3buffer,
+                W write) {
+  for (uint64_t first = 0; first < wav.num_samples;
+       first += encode_chunk_frames) {
+    size_t n = std::min<uint64_t>(encode_chunk_frames, wav.num_samples - first);
+    write(mp3buffer.get(), encode_frames(lgf, wav, first, n, mp3buffer.get(),
+                                         chunk_mp3buffer_size));
+  }
+  write(mp3buffer.get(),
+        lame_encode_flush(lgf, mp3buffer.get(), chunk_mp3buffer_size));
+}
 
-  ofstream file_out(filename_out, std::ios::binary);
-  file_out.write((const char *)mp3buffer.get(), bytes_written);
+// output name without ".mp3"
+string strip_mp3_ext(const string &filename) {
+  const string ext = ".mp3";
+  if (filename.size() >= ext.size() &&
+      filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0)
+    return filename.substr(0, filename.size() - ext.size());
+  return filename;
+}
 
-  bytes_written = lame_encode_flush(lgf.get(), mp3buffer.get(), mp3buffer_size);
-  file_out.write((const char *)mp3buffer.get(), bytes_written);
+// CBR output size of the decoded samples, enough to preallocate the output
+// in one piece; LAME adds up to about 2 frames of delay and padding
+uint64_t estimated_size(const wav_t &wav, unsigned bitrate, size_t tag_size) {
+  const uint64_t max_frame_size = 1441;
+  return wav.num_samples * bitrate * 125 / wav.sample_rate + tag_size +
+         3 * max_frame_size;
+}
 
-  file_out.close();
+// overwrites size bytes at offset of the concatenated chunks, nothing if they
+// are shorter than that
+void patch(write_behind::chunks &chunks, uint64_t offset, const uint8_t *data,
+           size_t size) {
+  uint64_t total = 0;
+  for (const vector<uint8_t> &c : chunks)
+    total += c.size();
+  if (size == 0 || total < offset + size)
+    return;
+  for (vector<uint8_t> &c : chunks) {
+    if (offset < c.size()) {
+      size_t n = std::min<uint64_t>(size, c.size() - offset);
+      std::copy(data, data + n, c.begin() + offset);
+      data += n;
+      size -= n;
+      offset = 0;
+      if (size == 0)
+        return;
+    } else
+      offset -= c.size();
+  }
+}
 
-  auto closer = [](FILE *f) {
-    if (f)
-      fclose(f);
+// encodes the decoded samples into one output, wav is only read, so several
+// of these can run on it at the same time
+// analysis is written as a ReplayGain tag if it isn't nullptr
+void encode(const wav_t &wav, unsigned bitrate, buffer &mp3buffer,
+            const string &filename_out, const convert::settings &s,
+            const loudness::result *analysis) {
+  bool segmented = s.segment_seconds > 0;
+  // initialized lame flags, prepared in the background when the pool runs
+  encoder_pool::lgf_ptr lgf = encoder_pool::acquire(
+      encoder_settings(wav, bitrate, segmented, s.quality, s.out_sample_rate));
+
+  buffer tag;
+  size_t tag_size = id3_tag(lgf.get(), s, analysis, tag);
+
+  // output is written while encoding, in steps of encode_chunk_frames; with
+  // the write-behind stage running the steps are collected and handed over
+  unique_ptr<segment::writer> segments;
+  unique_ptr<output_file> file_out;
+  write_behind::chunks collected;
+  if (segmented) {
+    segments.reset(new segment::writer(strip_mp3_ext(filename_out),
+                                       s.segment_seconds,
+                                       lame_get_out_samplerate(lgf.get()),
+                                       lame_get_framesize(lgf.get())));
+    segments->prefix(tag.get(), tag_size);
+  } else if (write_behind::running()) {
+    collected.emplace_back(tag.get(), tag.get() + tag_size);
+  } else {
+    file_out.reset(
+        new output_file(filename_out, estimated_size(wav, bitrate, tag_size)));
+    file_out->write(tag.get(), tag_size);
+  }
+  encode_all(lgf.get(), wav, mp3buffer,
+             [&](const uint8_t *data, size_t size) {
+               if (segments)
+                 segments->write(data, size);
+               else if (file_out)
+                 file_out->write(data, size);
+               else
+                 collected.emplace_back(data, data + size);
+             });
+
+  if (segments) {
+    segments->finish();
+    return;
+  }
+  // fill in the Xing/LAME tag frame LAME left empty behind the ID3v2 tag,
+  // as lame_mp3_tags_fid would after reopening the file
+  size_t lametag_size =
+      lame_get_lametag_frame(lgf.get(), mp3buffer.get(), chunk_mp3buffer_size);
+  if (!file_out) {
+    patch(collected, tag_size, mp3buffer.get(), lametag_size);
+    write_behind::submit(filename_out, std::move(collected));
+    return;
+  }
+  if (lametag_size > 0 && file_out->size() >= tag_size + lametag_size)
+    file_out->write_at(mp3buffer.get(), lametag_size, tag_size);
+  file_out->commit();
+}
+
+// output file of a ladder rung
+string rung_filename(const string &tmpl, const string &filename_out,
+                     unsigned bitrate) {
+  string name = strip_mp3_ext(filename_out);
+  string result = tmpl;
+  auto replace = [&result](const string &key, const string &value) {
+    for (size_t pos = result.find(key); pos != string::npos;
+         pos = result.find(key, pos + value.size()))
+      result.replace(pos, key.size(), value);
   };
-  unique_ptr<FILE, decltype(closer)> file_out_2(
-      fopen(filename_out.c_str(), "rb+"), closer);
-  lame_mp3_tags_fid(lgf.get(), file_out_2.get());
+  replace("{name}", name);
+  replace("{bitrate}", std::to_string(bitrate));
+  return result;
+}
+
+// reads and decodes a complete WAV file, analysis is only filled in if the
+// settings ask for loudness
+void load(std::istream &in, wav_t &wav, const convert::settings &s,
+          loudness::result &analysis) {
+  read_wav(in, wav, s.trim_threshold);
+  bool analyze = s.loudness_tags || s.loudness_sidecar;
+  decode(wav, s, analyze ? &analysis : nullptr);
+
+  if (wav.num_channels < 1 || wav.num_channels > 2)
+    throw runtime_error("Unsupported number of channels");
+}
+
+// converts a complete WAV file in memory with a single output, returns the
+// duration of the audio encoded in seconds
+double convert_in_memory(std::istream &in, std::vector<uint8_t> &out,
+                         const convert::settings &s) {
+  wav_t wav;
+  loudness::result analysis;
+  load(in, wav, s, analysis);
+
+  encoder_pool::lgf_ptr lgf =
+      encoder_pool::acquire(encoder_settings(wav, 128, false, s.quality,
+                                             s.out_sample_rate));
+  out.clear();
+  buffer tag;
+  size_t tag_size =
+      id3_tag(lgf.get(), s, s.loudness_tags ? &analysis : nullptr, tag);
+  out.insert(out.end(), tag.get(), tag.get() + tag_size);
+  buffer mp3buffer(chunk_mp3buffer_size);
+  encode_all(lgf.get(), wav, mp3buffer, [&out](const uint8_t *data, size_t size) {
+    out.insert(out.end(), data, data + size);
+  });
+  // LAME leaves the first frame empty for the Xing/LAME tag, which is only
+  // known now; lame_mp3_tags_fid does the same for files
+  size_t lametag_size = lame_get_lametag_frame(lgf.get(), nullptr, 0);
+  if (lametag_size > 0 && out.size() >= tag_size + lametag_size)
+    lame_get_lametag_frame(lgf.get(), out.data() + tag_size, lametag_size);
+  return (double)wav.num_samples / wav.sample_rate;
+}
+
+// no ladder, segments or sidecar
+bool single_output(const convert::settings &s) {
+  return s.bitrates.empty() && s.segment_seconds <= 0 && !s.loudness_sidecar;
+}
+
+// converts a complete WAV file in memory and writes its only output in one
+// go, returns the duration of the audio encoded in seconds
+double convert_single(std::istream &in, const string &filename_out,
+                      const convert::settings &s) {
+  thread_local vector<uint8_t> output;
+  double seconds = convert_in_memory(in, output, s);
+  if (write_behind::running()) {
+    write_behind::chunks data(1);
+    data[0].swap(output);
+    write_behind::submit(filename_out, std::move(data));
+    // a buffer the writer is done with takes the place of the one handed over
+    output = write_behind::spare();
+    return seconds;
+  }
+  output_file out(filename_out, output.size());
+  out.write(output.data(), output.size());
+  out.commit();
+  return seconds;
+}
+
+// encodes the loaded samples into all outputs the settings ask for, returns
+// the duration of the audio encoded in seconds
+double encode_outputs(const wav_t &wav, const loudness::result &analysis,
+                      const string &filename_out, const convert::settings &s) {
+  double seconds = (double)wav.num_samples / wav.sample_rate;
+
+  if (s.bitrates.empty()) {
+    buffer mp3buffer(chunk_mp3buffer_size);
+    encode(wav, 128, mp3buffer, filename_out, s,
+           s.loudness_tags ? &analysis : nullptr);
+  } else {
+    // one LAME context per rung, all reading the same samples; the buffers
+    // come from this thread's pool, the rung threads only borrow them
+    size_t num_rungs = s.bitrates.size();
+    vector<buffer> mp3buffers;
+    vector<string> errors(num_rungs);
+    for (size_t i = 0; i < num_rungs; ++i)
+      mp3buffers.emplace_back(chunk_mp3buffer_size);
+    auto rung = [&](size_t i) {
+      try {
+        encode(wav, s.bitrates[i], mp3buffers[i],
+               rung_filename(s.output_template, filename_out, s.bitrates[i]),
+               s, s.loudness_tags ? &analysis : nullptr);
+      } catch (std::exception &e) {
+        errors[i] = e.what();
+      }
+    };
+    {
+      vector<pthread_raii::pthread> threads;
+      threads.reserve(num_rungs - 1);
+      for (size_t i = 1; i < num_rungs; ++i)
+        threads.emplace_back(
+            pthread_raii::thread_options("rung-" + std::to_string(i)),
+            [&rung, i]() { rung(i); });
+      rung(0);
+    }
+    for (const string &e : errors)
+      if (!e.empty())
+        throw runtime_error(e);
+  }
+
+  if (s.loudness_sidecar) {
+    string json = loudness::to_json(analysis) + '\n';
+    // a ladder or segments never produce filename_out itself, so the sidecar
+    // takes the name they are derived from
+    bool single_file = s.bitrates.empty() && s.segment_seconds <= 0;
+    string name = single_file ? filename_out : strip_mp3_ext(filename_out);
+    output_file sidecar(name + ".loudness.json", json.size());
+    sidecar.write(json.data(), json.size());
+    sidecar.commit();
+  }
+  return seconds;
+}
+
+namespace convert {
+
+double convert(string filename_in, string filename_out, const settings &s) {
+  // small files with a single output skip the per-file stream overhead: one
+  // read into a buffer kept by the thread, the Xing/LAME tag patched in
+  // memory, and one write of the preallocated output
+  if (single_output(s)) {
+    thread_local vector<uint8_t> input;
+    if (util::read_small_file(filename_in, input, small_file_limit)) {
+      memory_buf buf(input.data(), input.size());
+      std::istream in(&buf);
+      return convert_single(in, filename_out, s);
+    }
+  }
+
+  wav_t wav;
+  loudness::result analysis;
+  {
+    std::ifstream file_in(filename_in, std::ios::binary);
+    load(file_in, wav, s, analysis);
+  }
+  return encode_outputs(wav, analysis, filename_out, s);
+}
+
+double convert(const uint8_t *data, size_t size, string filename_out,
+               const settings &s) {
+  memory_buf buf(data, size);
+  std::istream in(&buf);
+  if (single_output(s) && size <= small_file_limit)
+    return convert_single(in, filename_out, s);
+
+  wav_t wav;
+  loudness::result analysis;
+  load(in, wav, s, analysis);
+  return encode_outputs(wav, analysis, filename_out, s);
+}
+
+// bound for a small file from its size alone, as if every byte were a sample
+// of 8 bit mono at 8 kHz; its headers aren't read, which would take an open and
+// a read on top of the single read of the conversion
+uint64_t estimate_small_file(uint64_t file_size, const settings &s) {
+  const unsigned min_rate = 8000;
+  uint64_t frames = file_size;
+  uint64_t decoded = frames * sizeof(float);
+  // the file held by the job, its data chunk and the decoded copy
+  uint64_t peak = 2 * file_size + decoded;
+  if (s.out_sample_rate > min_rate)
+    peak = std::max(peak, file_size + decoded +
+                              frames * s.out_sample_rate / min_rate * 2 *
+                                  sizeof(float));
+  size_t num_outputs = std::max<size_t>(1, s.bitrates.size());
+  uint64_t mp3 = frames * 40000 / min_rate * num_outputs;
+  return peak + mp3 + num_outputs * encoder_overhead;
+}
+
+uint64_t estimate_memory(const string &filename_in, const settings &s) {
+  uint64_t file_size = util::file_size(filename_in);
+  if (file_size <= small_file_limit)
+    return estimate_small_file(file_size, s);
+  std::ifstream in(filename_in, std::ios::binary);
+  in.seekg(0, std::ios::end);
+  file_size = in ? (uint64_t)in.tellg() : 0;
+  in.seekg(0);
+  return estimate_memory(in, file_size, s);
+}
+
+uint64_t estimate_memory(const uint8_t *data, size_t size, const settings &s) {
+  memory_buf buf(data, size);
+  std::istream in(&buf);
+  return estimate_memory(in, size, s);
+}
+
+uint64_t estimate_memory(std::istream &in, uint64_t file_size,
+                         const settings &s) {
+  wav_t wav;
+  uint64_t data_size;
+  try {
+    data_size = read_wav_header(in, wav);
+  } catch (runtime_error &) {
+    // fails early in convert as well, or has the data chunk before fmt
+    return 3 * file_size + encoder_overhead;
+  }
+  if (data_size == unknown_size || data_size > file_size)
+    data_size = file_size;
+  uint64_t frame_sz = std::max(1u, wav.block_sz * wav.num_channels);
+  uint64_t frames = data_size / frame_sz;
+  unsigned rate = std::max(1u, wav.sample_rate);
+  unsigned rate_out = s.out_sample_rate ? s.out_sample_rate : rate;
+
+  // the data chunk next to its decoded copy as made by decode(), then the
+  // decoded copy next to the resampled one
+  downmix::matrix standard;
+  const downmix::matrix *m = downmix_matrix(wav, s, standard);
+  uint64_t decoded;
+  if (m || rate_out != rate || s.gain != 1.0f || s.loudness_tags ||
+      s.loudness_sidecar || (s.planar_float && planar_fast_path(wav)))
+    decoded = frames * (m ? m->out_channels : wav.num_channels) * sizeof(float);
+  else if (wav.format_code == WAVE_FORMAT_ALAW ||
+           wav.format_code == WAVE_FORMAT_MULAW)
+    decoded = frames * wav.num_channels * sizeof(short);
+  else if (wav.format_code == WAVE_FORMAT_PCM && wav.block_sz != sizeof(short) &&
+           wav.block_sz != sizeof(int))
+    decoded = frames * wav.num_channels *
+              (wav.block_sz < sizeof(short) ? sizeof(short) : sizeof(int));
+  else
+    // converted in place
+    decoded = 0;
+  uint64_t peak = data_size + decoded;
+  if (rate_out != rate)
+    peak = std::max(peak, decoded + frames * rate_out / rate * 2 * sizeof(float));
+
+  // outputs held in memory (write-behind, small files) at up to 320 kbps
+  size_t num_outputs = std::max<size_t>(1, s.bitrates.size());
+  uint64_t mp3 = frames * 40000 / rate * num_outputs;
+  if (file_size <= small_file_limit)
+    peak += file_size;
+  return peak + mp3 + num_outputs * encoder_overhead;
+}
+
+void convert(std::istream &in, std::vector<uint8_t> &out, const settings &s) {
+  convert_in_memory(in, out, s);
+}
+
+void convert_stream(std::istream &in, std::ostream &out, const settings &s) {
+  wav_t format;
+  uint64_t remaining = read_wav_header(in, format);
+  size_t frame_sz = format.block_sz * format.num_channels;
+
+  // blocks are decoded on their own, so LAME converts to the requested rate
+  settings block_settings = s;
+  block_settings.out_sample_rate = 0;
+
+  encoder_pool::lgf_ptr lgf(nullptr, lame_close);
+  int mp3buffer_size = (stream_block_frames * 5) / 4 + 7200;
+  buffer mp3buffer(mp3buffer_size);
+  wav_t block;
+  while (true) {
+    block.block_sz = format.block_sz;
+    block.sample_rate = format.sample_rate;
+    block.num_channels = format.num_channels;
+    block.format_code = format.format_code;
+    block.channel_mask = format.channel_mask;
+    size_t n = stream_block_frames;
+    if (remaining != unknown_size)
+      n = std::min<uint64_t>(n, remaining / frame_sz);
+    n = read_wav_frames(in, block, n);
+    if (remaining != unknown_size)
+      remaining -= n * frame_sz;
+    // the first block, even an empty one, decides the encoder settings
+    if (n == 0 && lgf)
+      break;
+    decode(block, block_settings, nullptr);
+    if (!lgf) {
+      if (block.num_channels < 1 || block.num_channels > 2)
+        throw runtime_error("Unsupported number of channels");
+      lgf = encoder_pool::acquire(
+          encoder_settings(block, 128, false, s.quality, s.out_sample_rate));
+    }
+    if (n == 0)
+      break;
+    int bytes_written = encode_frames(lgf.get(), block, 0, n, mp3buffer.get(),
+                                      mp3buffer_size);
+    // frames go out as soon as LAME has them
+    out.write((const char *)mp3buffer.get(), bytes_written);
+    out.flush();
+  }
+  int bytes_written =
+      lame_encode_flush(lgf.get(), mp3buffer.get(), mp3buffer_size);
+  out.write((const char *)mp3buffer.get(), bytes_written);
+  out.flush();
+  if (!out)
+    throw runtime_error("Can't write output stream");
+}
+void check_output_rate(const settings &s) {
+  if (!s.out_sample_rate)
+    return;
+  // MPEG-2, MPEG-1 and MPEG-2.5 each have their own rates and bitrates
+  for (int version = 0; version < 3; ++version)
+    for (int i = 0; i < 3; ++i) {
+      if (lame_get_samplerate(version, i) != (int)s.out_sample_rate)
+        continue;
+      vector<unsigned> bitrates = s.bitrates;
+      if (bitrates.empty())
+        bitrates.push_back(128);
+      for (unsigned bitrate : bitrates) {
+        bool valid = false;
+        for (int j = 1; j < 15; ++j)
+          valid = valid || lame_get_bitrate(version, j) == (int)bitrate;
+        if (!valid)
+          throw runtime_error("Bitrate " + std::to_string(bitrate) +
+                              " kbps isn't possible at " +
+                              std::to_string(s.out_sample_rate) + " Hz");
+      }
+      return;
+    }
+  throw runtime_error("MP3 has no sample rate " +
+                      std::to_string(s.out_sample_rate) + " Hz");
 }
 } // namespace convert
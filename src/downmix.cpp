@@ -0,0 +1,109 @@
+#include <sstream>
+#include <stdexcept>
+#include "downmix.h"
+
+namespace {
+  using std::runtime_error;
+
+  const float h=0.70710678f; // -3 dB
+  const float c8=0.92387953f;
+  const float s8=0.38268343f;
+
+  // left and right coefficients per speaker position bit of the channel mask
+  const float positions[][2] = {
+    {1,0}, {0,1}, {h,h}, {0,0},     // FL FR FC LFE
+    {h,0}, {0,h}, {c8,s8}, {s8,c8}, // BL BR FLC FRC
+    {.5f,.5f}, {h,0}, {0,h},        // BC SL SR
+    {.5f,.5f},                      // TC
+    {h,0}, {.5f,.5f}, {0,h},        // TFL TFC TFR
+    {h,0}, {.5f,.5f}, {0,h}         // TBL TBC TBR
+  };
+  const unsigned num_positions=sizeof(positions)/sizeof(positions[0]);
+
+  uint32_t default_mask(unsigned num_channels) {
+    switch(num_channels) {
+    case 3: return 0x7;   // FL FR FC
+    case 4: return 0x33;  // FL FR BL BR
+    case 5: return 0x37;  // FL FR FC BL BR
+    case 6: return 0x3F;  // 5.1
+    case 7: return 0x70F; // 6.1
+    case 8: return 0x63F; // 7.1
+    default: return 0;
+    }
+  }
+
+  void axpy(float* __restrict out, const float* __restrict in, float a, size_t n) {
+    for(size_t i=0;i<n;++i)
+      out[i]+=a*in[i];
+  }
+}
+
+namespace downmix {
+
+  matrix standard(unsigned num_channels, uint32_t channel_mask) {
+    if(channel_mask==0)
+      channel_mask=default_mask(num_channels);
+    matrix m{2,num_channels,std::vector<float>(2*num_channels)};
+    unsigned bit=0;
+    for(unsigned c=0;c<num_channels;++c) {
+      while(bit<32 && !(channel_mask&(1u<<bit)))
+        ++bit;
+      float l=h, r=h;
+      if(bit<num_positions) {
+        l=positions[bit][0];
+        r=positions[bit][1];
+      }
+      ++bit;
+      m.coeffs[c]=l;
+      m.coeffs[num_channels+c]=r;
+    }
+    for(unsigned row=0;row<2;++row) {
+      float sum=0;
+      for(unsigned c=0;c<num_channels;++c)
+        sum+=m.coeffs[row*num_channels+c];
+      if(sum>0)
+        for(unsigned c=0;c<num_channels;++c)
+          m.coeffs[row*num_channels+c]/=sum;
+    }
+    return m;
+  }
+
+  matrix parse(const std::string& s) {
+    matrix m{0,0,std::vector<float>()};
+    std::istringstream rows(s);
+    std::string row;
+    while(std::getline(rows,row,';')) {
+      std::istringstream cols(row);
+      std::string col;
+      unsigned n=0;
+      while(std::getline(cols,col,',')) {
+        std::istringstream value(col);
+        float v;
+        if(!(value>>v))
+          throw runtime_error("Malformed downmix matrix");
+        m.coeffs.push_back(v);
+        ++n;
+      }
+      if(n==0 || (m.out_channels>0 && n!=m.in_channels))
+        throw runtime_error("Malformed downmix matrix");
+      m.in_channels=n;
+      ++m.out_channels;
+    }
+    if(m.out_channels<1 || m.out_channels>2)
+      throw runtime_error("Downmix matrix needs 1 or 2 rows");
+    return m;
+  }
+
+  void mix(const matrix& m, const float* const* in, float* const* out, size_t num_frames) {
+    for(unsigned r=0;r<m.out_channels;++r) {
+      float* o=out[r];
+      for(size_t i=0;i<num_frames;++i)
+        o[i]=0;
+      for(unsigned c=0;c<m.in_channels;++c) {
+        float a=m.coeffs[r*m.in_channels+c];
+        if(a!=0)
+          axpy(o,in[c],a,num_frames);
+      }
+    }
+  }
+}
@@ -0,0 +1,185 @@
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include "encoder_pool.h"
+#include "pthread_raii.h"
+
+using encoder_pool::settings;
+
+namespace {
+  using namespace pthread_raii;
+  using std::runtime_error;
+
+  // contexts of keys that have not been asked for recently are dropped
+  const size_t max_keys=8;
+
+  struct entry {
+    std::deque<lame_global_flags*> ready;
+    uint64_t last_used;
+  };
+
+  pmutex m;
+  pcond c;
+  std::map<settings,entry> entries;
+  uint64_t use_counter=0;
+  int depth=0;
+  bool running=false;
+  std::unique_ptr<pthread> refill_thread;
+
+  std::atomic<uint64_t> hits(0);
+  std::atomic<uint64_t> misses(0);
+
+  lame_global_flags* create(const settings& s) {
+    lame_global_flags* lgf=lame_init();
+    if(!lgf)
+      throw runtime_error("Initialization of lame failed");
+    try {
+      encoder_pool::set_lgf(lgf,s);
+    }
+    catch(runtime_error&) {
+      lame_close(lgf);
+      throw;
+    }
+    return lgf;
+  }
+
+  void close_all(entry& e) {
+    for(lame_global_flags* lgf:e.ready)
+      lame_close(lgf);
+    e.ready.clear();
+  }
+
+  // needs m to be held
+  entry& touch(const settings& s) {
+    entry& e=entries[s];
+    e.last_used=++use_counter;
+    if(entries.size()>max_keys) {
+      auto lru=entries.begin();
+      for(auto it=entries.begin();it!=entries.end();++it)
+        if(it->second.last_used<lru->second.last_used)
+          lru=it;
+      close_all(lru->second);
+      entries.erase(lru);
+    }
+    return e;
+  }
+
+  // needs m to be held
+  bool next_missing(settings& s) {
+    for(auto& e:entries) {
+      if(e.second.ready.size()<(size_t)depth) {
+        s=e.first;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void refill() {
+    while(true) {
+      settings s=settings();
+      {
+        plock_guard g(m);
+        while(running && !next_missing(s))
+          c.wait(m);
+        if(!running)
+          return;
+      }
+
+      lame_global_flags* lgf=nullptr;
+      try {
+        lgf=create(s);
+      }
+      catch(runtime_error&) {
+      }
+
+      plock_guard g(m);
+      auto it=entries.find(s);
+      if(!lgf) {
+        // settings lame rejects are not retried
+        if(it!=entries.end()) {
+          close_all(it->second);
+          entries.erase(it);
+        }
+      }
+      else if(it==entries.end() || !running)
+        lame_close(lgf);
+      else
+        it->second.ready.push_back(lgf);
+    }
+  }
+}
+
+namespace encoder_pool {
+
+  bool settings::operator<(const settings& other) const {
+    return std::tie(sample_rate,out_sample_rate,num_channels,mode,bitrate,quality,segmented)<
+      std::tie(other.sample_rate,other.out_sample_rate,other.num_channels,other.mode,other.bitrate,other.quality,
+               other.segmented);
+  }
+
+  void set_lgf(lame_global_flags* lgf, const settings& s) {
+    lame_set_num_channels(lgf,s.num_channels);
+    lame_set_in_samplerate(lgf,s.sample_rate);
+    if(s.out_sample_rate)
+      lame_set_out_samplerate(lgf,s.out_sample_rate);
+    lame_set_mode(lgf,s.mode);
+    lame_set_brate(lgf,s.bitrate);
+    lame_set_quality(lgf,s.quality);
+    if(s.segmented) {
+      lame_set_disable_reservoir(lgf,1);
+      lame_set_bWriteVbrTag(lgf,0);
+    }
+    if(lame_init_params(lgf)<0)
+      throw runtime_error("Initialization of lame flags failed");
+  }
+
+  lgf_ptr acquire(const settings& s) {
+    {
+      plock_guard g(m);
+      if(running) {
+        entry& e=touch(s);
+        c.signal();
+        if(!e.ready.empty()) {
+          lame_global_flags* lgf=e.ready.front();
+          e.ready.pop_front();
+          ++hits;
+          return lgf_ptr(lgf,&lame_close);
+        }
+      }
+    }
+    ++misses;
+    return lgf_ptr(create(s),&lame_close);
+  }
+
+  void start(int d) {
+    if(d<=0)
+      return;
+    {
+      plock_guard g(m);
+      depth=d;
+      running=true;
+    }
+    refill_thread.reset(new pthread(thread_options("encoder-pool"),refill));
+  }
+
+  void stop() {
+    {
+      plock_guard g(m);
+      running=false;
+      c.broadcast();
+    }
+    refill_thread.reset();
+    plock_guard g(m);
+    for(auto& e:entries)
+      close_all(e.second);
+    entries.clear();
+  }
+
+  stats_t stats() {
+    return stats_t{hits.load(),misses.load()};
+  }
+}
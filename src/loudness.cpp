@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include "loudness.h"
+#include "pcm.h"
+
+namespace {
+  const double pi=3.14159265358979323846;
+  const double absolute_gate=-70;
+  const double relative_gate=-10;
+  const double replaygain_reference=-18;
+  // 16 bit full scale
+  const float clip_level=32767.0f/32768.0f;
+
+  const unsigned os_factor=4;
+  const unsigned os_taps=12;
+
+  double bessel_i0(double x) {
+    double sum=1, term=1;
+    for(int k=1;k<50 && term>1e-12*sum;++k) {
+      term*=(x/(2*k))*(x/(2*k));
+      sum+=term;
+    }
+    return sum;
+  }
+
+  // 4 phase interpolator, Kaiser windowed sinc with 12 taps per phase as in BS.1770 annex 2
+  struct oversampler {
+    float h[os_factor][os_taps];
+    oversampler() {
+      const double beta=6.0;
+      double half=os_taps/2.0;
+      for(unsigned p=0;p<os_factor;++p) {
+        double sum=0;
+        for(unsigned k=0;k<os_taps;++k) {
+          double tau=(double)p/os_factor+half-1-k;
+          double r=tau/half;
+          double window=r*r<1 ? bessel_i0(beta*std::sqrt(1-r*r))/bessel_i0(beta) : 0;
+          double v=(tau==0 ? 1 : std::sin(pi*tau)/(pi*tau))*window;
+          h[p][k]=(float)v;
+          sum+=v;
+        }
+        for(unsigned k=0;k<os_taps;++k)
+          h[p][k]=(float)(h[p][k]/sum);
+      }
+    }
+  };
+
+  double lufs(double mean_square) {
+    return -0.691+10*std::log10(mean_square);
+  }
+
+  void axpy(float* __restrict out, const float* __restrict in, float a, size_t n) {
+    for(size_t i=0;i<n;++i)
+      out[i]+=a*in[i];
+  }
+
+  uint64_t count_clipped(const float* __restrict x, size_t n) {
+    uint64_t count=0;
+    for(size_t i=0;i<n;++i)
+      count+=std::fabs(x[i])>=clip_level;
+    return count;
+  }
+}
+
+namespace loudness {
+
+  double replaygain(const result& r) {
+    return replaygain_reference-r.integrated;
+  }
+
+  std::string to_json(const result& r) {
+    char buf[256];
+    if(std::isinf(r.integrated))
+      snprintf(buf,sizeof(buf),
+               "{\"integrated_lufs\": null, \"replaygain_track_gain_db\": null, "
+               "\"sample_peak\": %.6f, \"true_peak\": %.6f, \"clipped_samples\": %llu}",
+               r.sample_peak,r.true_peak,(unsigned long long)r.clipped);
+    else
+      snprintf(buf,sizeof(buf),
+               "{\"integrated_lufs\": %.2f, \"replaygain_track_gain_db\": %.2f, "
+               "\"sample_peak\": %.6f, \"true_peak\": %.6f, \"clipped_samples\": %llu}",
+               r.integrated,replaygain(r),r.sample_peak,r.true_peak,(unsigned long long)r.clipped);
+    return buf;
+  }
+
+  meter::meter(unsigned sample_rate, unsigned num_channels)
+    : channels_(num_channels), subblock_len_(std::max(1u,(sample_rate+5)/10)), subblock_fill_(0),
+      subblock_energy_(0), total_energy_(0), total_frames_(0), sample_peak_(0), true_peak_(0), clipped_(0) {
+    // K-weighting for any sample rate: high shelf followed by the RLB high pass
+    double k=std::tan(pi*1681.974450955533/sample_rate);
+    double q=0.7071752369554196;
+    double vh=std::pow(10.0,3.999843853973347/20);
+    double vb=std::pow(vh,0.4996667741545416);
+    double a0=1+k/q+k*k;
+    stages_[0]=biquad{(vh+vb*k/q+k*k)/a0, 2*(k*k-vh)/a0, (vh-vb*k/q+k*k)/a0, 2*(k*k-1)/a0, (1-k/q+k*k)/a0};
+    k=std::tan(pi*38.13547087602444/sample_rate);
+    q=0.5003270373238773;
+    a0=1+k/q+k*k;
+    stages_[1]=biquad{1, -2, 1, 2*(k*k-1)/a0, (1-k/q+k*k)/a0};
+    for(channel_state& ch:channels_) {
+      memset(ch.z,0,sizeof(ch.z));
+      ch.history.assign(os_taps-1,0.0f);
+    }
+  }
+
+  // the filters are recursive, so this part stays scalar
+  double meter::weighted_energy(channel_state& ch, const float* x, size_t n) const {
+    double energy=0;
+    double z00=ch.z[0][0], z01=ch.z[0][1], z10=ch.z[1][0], z11=ch.z[1][1];
+    const biquad& s0=stages_[0];
+    const biquad& s1=stages_[1];
+    for(size_t i=0;i<n;++i) {
+      double in=x[i];
+      double y0=s0.b0*in+z00;
+      z00=s0.b1*in-s0.a1*y0+z01;
+      z01=s0.b2*in-s0.a2*y0;
+      double y1=s1.b0*y0+z10;
+      z10=s1.b1*y0-s1.a1*y1+z11;
+      z11=s1.b2*y0-s1.a2*y1;
+      energy+=y1*y1;
+    }
+    ch.z[0][0]=z00;
+    ch.z[0][1]=z01;
+    ch.z[1][0]=z10;
+    ch.z[1][1]=z11;
+    return energy;
+  }
+
+  float meter::oversampled_peak(channel_state& ch, const float* x, size_t n) {
+    static const oversampler os;
+    scratch_.resize(n+os_taps-1);
+    acc_.resize(n);
+    std::copy(ch.history.begin(),ch.history.end(),scratch_.begin());
+    std::copy(x,x+n,scratch_.begin()+os_taps-1);
+    float peak=0;
+    for(unsigned p=0;p<os_factor;++p) {
+      std::fill(acc_.begin(),acc_.end(),0.0f);
+      for(unsigned k=0;k<os_taps;++k)
+        axpy(acc_.data(),scratch_.data()+k,os.h[p][k],n);
+      peak=std::max(peak,pcm::peak(acc_.data(),n));
+    }
+    std::copy(scratch_.end()-(os_taps-1),scratch_.end(),ch.history.begin());
+    return peak;
+  }
+
+  void meter::process(const float* const* samples, size_t num_frames) {
+    for(size_t c=0;c<channels_.size();++c) {
+      sample_peak_=std::max(sample_peak_,pcm::peak(samples[c],num_frames));
+      true_peak_=std::max(true_peak_,oversampled_peak(channels_[c],samples[c],num_frames));
+      clipped_+=count_clipped(samples[c],num_frames);
+    }
+    size_t done=0;
+    while(done<num_frames) {
+      size_t n=std::min(num_frames-done,subblock_len_-subblock_fill_);
+      for(size_t c=0;c<channels_.size();++c)
+        subblock_energy_+=weighted_energy(channels_[c],samples[c]+done,n);
+      subblock_fill_+=n;
+      done+=n;
+      if(subblock_fill_==subblock_len_) {
+        subblocks_.push_back(subblock_energy_/subblock_len_);
+        total_energy_+=subblock_energy_;
+        subblock_energy_=0;
+        subblock_fill_=0;
+      }
+    }
+    total_frames_+=num_frames;
+  }
+
+  result meter::finish() const {
+    // 400 ms gating blocks overlapping by 75%
+    std::vector<double> blocks;
+    for(size_t i=0;i+4<=subblocks_.size();++i)
+      blocks.push_back((subblocks_[i]+subblocks_[i+1]+subblocks_[i+2]+subblocks_[i+3])/4);
+    // clips shorter than one gating block are measured as a whole
+    if(blocks.empty() && total_frames_>0)
+      blocks.push_back((total_energy_+subblock_energy_)/total_frames_);
+
+    double sum=0;
+    size_t n=0;
+    for(double z:blocks)
+      if(lufs(z)>absolute_gate) {
+        sum+=z;
+        ++n;
+      }
+    double integrated=-std::numeric_limits<double>::infinity();
+    if(n>0) {
+      double gate=lufs(sum/n)+relative_gate;
+      sum=0;
+      n=0;
+      for(double z:blocks)
+        if(lufs(z)>absolute_gate && lufs(z)>gate) {
+          sum+=z;
+          ++n;
+        }
+      integrated=lufs(sum/n);
+    }
+    return result{integrated,sample_peak_,true_peak_,clipped_};
+  }
+}
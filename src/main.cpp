@@ -2,9 +2,28 @@
 #include <vector>
 #include <string>
 #include <cctype>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 #include "util.h"
 #include "pthread_raii.h"
 #include "convert.h"
+#include "wav2mp3.h"
+#include "server.h"
+#include "tar.h"
+#include "watch.h"
+#include "worker_pool.h"
+#include "write_behind.h"
+#include "buffer_pool.h"
+#include "encoder_pool.h"
+#include "memory_budget.h"
+#include "concurrency.h"
+#include "backlog.h"
+#include "prefetch.h"
 
 using std::cout;
 using std::endl;
@@ -18,50 +37,487 @@ using namespace pthread_raii;
 
 vector<string> filenames;
 string dirname;
+convert::settings settings;
 pmutex m_stack;
 pmutex m_io;
 
-void do_work() {
+std::atomic<uint64_t> files_converted(0);
+std::atomic<uint64_t> convert_ns(0);
+// wall time of a directory run, 0 in the other modes
+double run_seconds=0;
+// filenames taken from the stack at a time, more than one for many files so
+// short clips don't spend their time on m_stack
+size_t claim_batch=1;
+
+struct deferred_job {
+  string filename;
+  uint64_t bytes;
+};
+// jobs that didn't fit into the memory budget when they were claimed, guarded by m_stack
+vector<deferred_job> deferred;
+// hands the inputs to the workers instead of filenames if I/O threads read ahead
+std::unique_ptr<prefetch::reader> inputs;
+
+// files not yet taken by any worker
+size_t queued_files() {
+  if(inputs)
+    return inputs->remaining();
+  plock_guard g(m_stack);
+  return filenames.size()+deferred.size();
+}
+
+// held is the number of files the calling worker has claimed behind this one,
+// in is the input if it was read ahead
+void convert_file(const string& filename, size_t held, const prefetch::input* in=nullptr) {
+  // with a drain target the quality drops while the backlog is too long for it
+  convert::settings degraded;
+  int quality=settings.quality;
+  if(backlog::target()>0) {
+    quality=backlog::quality(queued_files()+held,settings.quality);
+    if(quality!=settings.quality) {
+      degraded=settings;
+      degraded.quality=quality;
+    }
+  }
+  try {
+    auto start=std::chrono::steady_clock::now();
+    concurrency::job_timer timer;
+    const convert::settings& s=quality==settings.quality ? settings : degraded;
+    string filename_out=dirname+filename.substr(0,filename.size()-wav_ext.size())+mp3_ext;
+    double seconds=in && in->loaded ? convert::convert(in->data.data(),in->data.size(),filename_out,s)
+                                    : convert::convert(dirname+filename,filename_out,s);
+    timer.finish(seconds);
+    auto elapsed=std::chrono::steady_clock::now()-start;
+    convert_ns+=std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    backlog::record(std::chrono::duration<double>(elapsed).count(),quality);
+    ++files_converted;
+  }
+  catch(std::runtime_error& e) {
+    plock_guard g(m_io);
+    std::cerr<<"File "<<filename<<": "<<e.what()<<endl;
+  }
+}
+
+// estimated peak memory of a job, the headers are only read with a budget set
+uint64_t job_memory(const string& filename) {
+  return memory_budget::limit() ? convert::estimate_memory(dirname+filename,settings) : 0;
+}
+
+// workers only take inputs the I/O threads have read; the memory budget is waited for
+// in order, as the prefetch bound already holds the next inputs back
+void do_prefetched_work(unsigned index) {
+  prefetch::input in;
   while(true) {
-    string filename;
-    
+    concurrency::admit(index);
+    if(!inputs->next(in)) {
+      concurrency::drain();
+      return;
+    }
+    string filename=in.filename.substr(dirname.size());
+    uint64_t bytes=0;
+    if(memory_budget::limit())
+      bytes=in.loaded ? convert::estimate_memory(in.data.data(),in.data.size(),settings) : job_memory(filename);
+    memory_budget::acquire(bytes);
+    memory_budget::reservation r(bytes);
+    convert_file(filename,0,&in);
+  }
+}
+
+void do_work(unsigned index) {
+  vector<string> batch;
+  while(true) {
+    // workers outside the active set of the concurrency controller wait here
+    concurrency::admit(index);
+    deferred_job job{string(),0};
+    bool reserved=false;
     {
       //access to the filenames stack is serialized with a mutex
       plock_guard g(m_stack);
-      if(filenames.empty())
-        return;
-      filename=filenames.back();
-      filenames.pop_back();
+      // deferred jobs go first as soon as they fit, once there is nothing else left
+      // they are waited for
+      for(auto it=deferred.begin();it!=deferred.end() && !reserved;++it) {
+        if(memory_budget::try_acquire(it->bytes)) {
+          job=*it;
+          deferred.erase(it);
+          reserved=true;
+        }
+      }
+      if(!reserved) {
+        if(!filenames.empty()) {
+          size_t n=std::min(claim_batch,filenames.size());
+          batch.assign(filenames.end()-n,filenames.end());
+          filenames.resize(filenames.size()-n);
+        }
+        else if(!deferred.empty()) {
+          job=deferred.back();
+          deferred.pop_back();
+        }
+        else {
+          // workers parked by the controller have to see this as well
+          concurrency::drain();
+          return;
+        }
+      }
     }
 
-    try {
-      convert::convert(dirname+filename, dirname+filename.substr(0,filename.size()-wav_ext.size())+mp3_ext);
+    if(!job.filename.empty()) {
+      if(!reserved)
+        memory_budget::acquire(job.bytes);
+      memory_budget::reservation r(job.bytes);
+      convert_file(job.filename,0);
+      continue;
     }
-    catch(std::runtime_error& e) {
-      plock_guard g(m_io);
-      std::cerr<<"File "<<filename<<": "<<e.what()<<endl;
+    // jobs too large for the memory left are put aside, smaller ones go ahead
+    for(size_t i=0;i<batch.size();++i) {
+      const string& filename=batch[i];
+      uint64_t bytes=job_memory(filename);
+      if(!memory_budget::try_acquire(bytes)) {
+        plock_guard g(m_stack);
+        deferred.push_back(deferred_job{filename,bytes});
+        continue;
+      }
+      memory_budget::reservation r(bytes);
+      convert_file(filename,batch.size()-i-1);
     }
+    batch.clear();
   }
 }
 
 
+void print_stats() {
+  const double mib=1024.0*1024.0;
+  buffer_pool::stats_t s=buffer_pool::stats();
+  cout<<"buffer pool: "<<s.bytes_reused/mib<<" MiB reused ("<<s.num_reused<<" buffers), "
+      <<s.bytes_allocated/mib<<" MiB newly allocated ("<<s.num_allocated<<" buffers)"<<endl;
+  encoder_pool::stats_t e=encoder_pool::stats();
+  cout<<"encoder pool: "<<e.hits<<" prepared contexts used, "<<e.misses<<" initialized on demand"<<endl;
+  memory_budget::stats_t m=memory_budget::stats();
+  if(memory_budget::limit())
+    cout<<"memory budget: "<<memory_budget::limit()/mib<<" MiB, peak reservation "<<m.peak/mib<<" MiB, "
+        <<m.waits<<" jobs waited "<<m.wait_ms<<" ms for memory"<<endl;
+  write_behind::stats_t w=write_behind::stats();
+  if(w.batches)
+    cout<<"write-behind: "<<w.files<<" files, "<<w.bytes/mib<<" MiB in "<<w.batches<<" batches, "
+        <<w.fsyncs<<" fsyncs, "<<w.failed<<" failed, workers waited "<<w.wait_ms<<" ms for output"<<endl;
+  concurrency::stats_t c=concurrency::stats();
+  if(c.decisions)
+    cout<<"concurrency: "<<c.changes<<" changes in "<<c.decisions<<" decisions, "<<c.fewest<<" to "<<c.most
+        <<" workers, "<<c.active<<" at the end"<<endl;
+  if(backlog::target()>0) {
+    backlog::stats_t b=backlog::stats();
+    cout<<"quality:";
+    const char* sep=" ";
+    for(int q=0;q<backlog::num_qualities;++q)
+      if(b.jobs[q]) {
+        cout<<sep<<b.jobs[q]<<" jobs at "<<q;
+        sep=", ";
+      }
+    cout<<" ("<<b.degraded<<" degraded to meet the drain target)"<<endl;
+  }
+  prefetch::stats_t p=prefetch::stats();
+  if(p.loaded+p.hinted) {
+    cout<<"prefetch: "<<p.loaded<<" inputs read ahead ("<<p.bytes/mib<<" MiB), "<<p.hinted<<" left to the page cache, "
+        <<p.mean_depth<<" ready on average; workers waited "<<p.worker_waits<<" times ("<<p.worker_wait_ms
+        <<" ms) for input, I/O threads "<<p.reader_waits<<" times ("<<p.reader_wait_ms<<" ms) for room: "
+        <<(p.worker_wait_ms>p.reader_wait_ms ? "I/O bound" : "CPU bound")<<endl;
+  }
+  // outputs the writer thread failed to write were counted when their jobs finished
+  uint64_t n=files_converted-std::min<uint64_t>(files_converted,w.failed);
+  if(n) {
+    cout<<"files: "<<n<<" converted, "<<convert_ns/1e6/n<<" ms mean latency";
+    if(run_seconds>0)
+      cout<<", "<<n/run_seconds<<" files/s";
+    cout<<endl;
+  }
+}
+
 int main(int argc, char** argv) {
-  
-  if(argc<2)
-    dirname=".";
-  else
-    dirname=string(argv[1]);
+  bool stats=false;
+  bool pipe=false;
+  bool tar=false;
+  string socket_path;
+  size_t queue_capacity=0;
+  bool watch=false;
+  size_t write_behind_mib=64;
+  // leaves a quarter of the cgroup limit for LAME, the buffer pools and the rest of the process
+  uint64_t memory_budget_mib=util::memory_limit()/4*3>>20;
+  write_behind::durability durability=write_behind::durability::none;
+  unsigned debounce_ms=100;
+  int n_cores=util::num_cores();
+  // one prepared encoder per worker unless --encoder-pool says otherwise, set once --workers is known
+  int pool_depth=-1;
+  // bounds of the adaptive worker count, max_workers 0 keeps n_cores workers
+  unsigned min_workers=0, max_workers=0;
+  double adapt_window=2;
+  double drain_target=0;
+  unsigned prefetch_threads=0;
+  size_t prefetch_depth=0;
+  size_t prefetch_mib=64;
+  dirname=".";
+  for(int i=1;i<argc;++i) {
+    string arg(argv[i]);
+    if(arg=="--stats")
+      stats=true;
+    else if(arg=="--pipe")
+      pipe=true;
+    else if(arg=="--tar")
+      tar=true;
+    else if(arg=="--daemon" && i+1<argc)
+      socket_path=argv[++i];
+    else if(arg=="--watch")
+      watch=true;
+    else if(arg=="--debounce" && i+1<argc)
+      debounce_ms=std::atoi(argv[++i]);
+    else if(arg=="--queue" && i+1<argc)
+      queue_capacity=std::atoi(argv[++i]);
+    else if(arg=="--write-behind" && i+1<argc)
+      write_behind_mib=std::atoi(argv[++i]);
+    else if(arg=="--memory-budget" && i+1<argc)
+      memory_budget_mib=std::atoll(argv[++i]);
+    else if(arg=="--fsync" && i+1<argc) {
+      try {
+        durability=write_behind::parse_durability(argv[++i]);
+      }
+      catch(std::runtime_error& e) {
+        cerr<<e.what()<<endl;
+        return 1;
+      }
+    }
+    else if(arg=="--workers" && i+1<argc)
+      n_cores=std::max(1,std::atoi(argv[++i]));
+    else if(arg=="--quality" && i+1<argc) {
+      settings.quality=std::atoi(argv[++i]);
+      if(settings.quality<0 || settings.quality>9) {
+        cerr<<"Invalid quality "<<argv[i]<<endl;
+        return 1;
+      }
+    }
+    else if(arg=="--drain-target" && i+1<argc) {
+      drain_target=std::atof(argv[++i]);
+      settings.quality_tag=drain_target>0;
+    }
+    else if(arg=="--prefetch" && i+1<argc)
+      prefetch_threads=std::atoi(argv[++i]);
+    else if(arg=="--prefetch-depth" && i+1<argc)
+      prefetch_depth=std::atoi(argv[++i]);
+    else if(arg=="--prefetch-mib" && i+1<argc)
+      prefetch_mib=std::atoi(argv[++i]);
+    else if(arg=="--adaptive" && i+1<argc) {
+      // MIN,MAX
+      string bounds(argv[++i]);
+      size_t comma=bounds.find(',');
+      min_workers=std::atoi(bounds.c_str());
+      max_workers=comma==string::npos ? 0 : std::atoi(bounds.c_str()+comma+1);
+      if(min_workers==0 || max_workers<min_workers) {
+        cerr<<"Invalid worker bounds "<<bounds<<endl;
+        return 1;
+      }
+    }
+    else if(arg=="--adapt-window" && i+1<argc)
+      adapt_window=std::atof(argv[++i]);
+    else if(arg=="--pin")
+      util::set_pin_workers(true);
+    else if(arg=="--huge-pages")
+      buffer_pool::set_huge_pages(true);
+    else if(arg=="--encoder-pool" && i+1<argc)
+      pool_depth=std::max(0,std::atoi(argv[++i]));
+    else if(arg=="--downmix" && i+1<argc) {
+      try {
+        settings.downmix_matrices.push_back(downmix::parse(argv[++i]));
+      }
+      catch(std::runtime_error& e) {
+        cerr<<e.what()<<endl;
+        return 1;
+      }
+    }
+    else if(arg=="--gain" && i+1<argc)
+      settings.gain=std::pow(10.0f,(float)std::atof(argv[++i])/20);
+    else if(arg=="--trim" && i+1<argc)
+      settings.trim_threshold=std::pow(10.0f,(float)std::atof(argv[++i])/20);
+    else if(arg=="--loudness" && i+1<argc) {
+      string mode(argv[++i]);
+      if(mode!="tags" && mode!="sidecar" && mode!="both") {
+        cerr<<"Unknown loudness mode "<<mode<<endl;
+        return 1;
+      }
+      settings.loudness_tags=mode=="tags" || mode=="both";
+      settings.loudness_sidecar=mode=="sidecar" || mode=="both";
+    }
+    else if(arg=="--bitrates" && i+1<argc) {
+      // comma separated list of kbps
+      string list(argv[++i]);
+      for(size_t pos=0;pos<list.size();) {
+        size_t end=list.find(',',pos);
+        if(end==string::npos)
+          end=list.size();
+        unsigned bitrate=std::atoi(list.substr(pos,end-pos).c_str());
+        if(bitrate==0) {
+          cerr<<"Invalid bitrate list "<<list<<endl;
+          return 1;
+        }
+        settings.bitrates.push_back(bitrate);
+        pos=end+1;
+      }
+    }
+    else if(arg=="--output-template" && i+1<argc)
+      settings.output_template=argv[++i];
+    else if(arg=="--segment" && i+1<argc)
+      settings.segment_seconds=std::atof(argv[++i]);
+    else if(arg=="--no-planar-float")
+      settings.planar_float=false;
+    else if(arg=="--resample" && i+1<argc)
+      settings.out_sample_rate=std::atoi(argv[++i]);
+    else if(arg=="--resample-quality" && i+1<argc) {
+      try {
+        settings.resample_quality=resample::parse_quality(argv[++i]);
+      }
+      catch(std::runtime_error& e) {
+        cerr<<e.what()<<endl;
+        return 1;
+      }
+    }
+    else
+      dirname=arg;
+  }
+  try {
+    convert::check_output_rate(settings);
+  }
+  catch(std::runtime_error& e) {
+    cerr<<e.what()<<endl;
+    return 1;
+  }
+  if(pool_depth<0)
+    pool_depth=n_cores;
+  memory_budget::set_limit(memory_budget_mib<<20);
+  // with adaptive concurrency max_workers threads exist and the controller decides how many of
+  // them work, starting from n_cores
+  int num_workers=n_cores;
+  backlog::set_target(drain_target,n_cores);
+  auto start_concurrency=[&]() {
+    if(!max_workers)
+      return;
+    num_workers=max_workers;
+    concurrency::start(concurrency::settings{min_workers,max_workers,(unsigned)n_cores,adapt_window},
+                       [](const string& line) {
+                         plock_guard g(m_io);
+                         cerr<<line<<endl;
+                       });
+  };
+  if(pipe) {
+    try {
+      wav2mp3::converter c(settings);
+      c.convert([](uint8_t* buffer, size_t size) { return fread(buffer,1,size,stdin); },
+                [](const uint8_t* data, size_t size) {
+                  fwrite(data,1,size,stdout);
+                  fflush(stdout);
+                });
+    }
+    catch(std::runtime_error& e) {
+      cerr<<"stdin: "<<e.what()<<endl;
+      return 1;
+    }
+    return 0;
+  }
+  if(tar) {
+    std::ios::sync_with_stdio(false);
+    encoder_pool::start(pool_depth);
+    try {
+      tar::convert(std::cin,std::cout,settings,n_cores,queue_capacity ? queue_capacity : 4*n_cores);
+    }
+    catch(std::runtime_error& e) {
+      cerr<<"stdin: "<<e.what()<<endl;
+      encoder_pool::stop();
+      return 1;
+    }
+    encoder_pool::stop();
+    if(stats)
+      print_stats();
+    return 0;
+  }
+  if(!socket_path.empty()) {
+    encoder_pool::start(pool_depth);
+    start_concurrency();
+    try {
+      server::serve(socket_path,settings,num_workers,queue_capacity ? queue_capacity : 4*n_cores);
+    }
+    catch(std::runtime_error& e) {
+      cerr<<e.what()<<endl;
+      concurrency::stop();
+      encoder_pool::stop();
+      return 1;
+    }
+    concurrency::stop();
+    encoder_pool::stop();
+    if(stats)
+      print_stats();
+    return 0;
+  }
   if(dirname[dirname.size()-1]!=util::slash)
     dirname+=util::slash;
-  
-  int n_cores=util::num_cores();
+
+  // workers hand their outputs to the writer thread in directory and watch mode; daemon jobs
+  // are only answered once their output exists, so they keep writing themselves
+  if(write_behind_mib)
+    write_behind::start(write_behind_mib<<20,durability);
+
+  if(watch) {
+    encoder_pool::start(pool_depth);
+    start_concurrency();
+    try {
+      worker_pool::pool workers(settings,num_workers,queue_capacity ? queue_capacity : 4*n_cores);
+      watch::run(dirname,workers,debounce_ms);
+    }
+    catch(std::runtime_error& e) {
+      cerr<<e.what()<<endl;
+      concurrency::stop();
+      write_behind::stop();
+      encoder_pool::stop();
+      return 1;
+    }
+    concurrency::stop();
+    write_behind::stop();
+    encoder_pool::stop();
+    if(stats)
+      print_stats();
+    return 0;
+  }
 
   auto ends_with_wav=[](string s) { return wav_ext.size()<=s.size() && util::string_to_lower(s.substr(s.size()-wav_ext.size()))==wav_ext;};
   util::list_files(dirname, filenames, ends_with_wav);
+  // a few batches per thread keep the load balanced at the end of the run
+  claim_batch=std::max<size_t>(1,std::min<size_t>(64,filenames.size()/(8*n_cores)));
 
-  vector<pthread> threads;
-  threads.reserve(n_cores);
+  auto start=std::chrono::steady_clock::now();
+  encoder_pool::start(pool_depth);
+  start_concurrency();
+  if(prefetch_threads) {
+    // in list order, which the workers would have claimed them in from the back
+    vector<string> paths;
+    paths.reserve(filenames.size());
+    for(auto it=filenames.rbegin();it!=filenames.rend();++it)
+      paths.push_back(dirname+*it);
+    filenames.clear();
+    inputs.reset(new prefetch::reader(std::move(paths),prefetch_threads,
+                                      prefetch_depth ? prefetch_depth : 2*num_workers,prefetch_mib<<20));
+  }
+  {
+    vector<pthread> threads;
+    threads.reserve(num_workers);
+
+    for(int i=0;i<num_workers;++i)
+      threads.emplace_back(util::worker_thread("worker",i),[i]() {
+        if(inputs)
+          do_prefetched_work(i);
+        else
+          do_work(i);
+      });
+  }
+  inputs.reset();
+  concurrency::stop();
+  write_behind::stop();
+  encoder_pool::stop();
+  run_seconds=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
 
-  while(n_cores--)
-    threads.emplace_back(do_work);
+  if(stats)
+    print_stats();
 }
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <chrono>
+#include "memory_budget.h"
+#include "pthread_raii.h"
+
+namespace {
+  using namespace pthread_raii;
+
+  pmutex m;
+  pcond released;
+  uint64_t budget=0;
+  uint64_t reserved=0;
+  uint64_t peak=0;
+  uint64_t waits=0;
+  uint64_t wait_ns=0;
+
+  // needs m to be held
+  bool fits(uint64_t bytes) {
+    return budget==0 || reserved==0 || reserved+bytes<=budget;
+  }
+
+  // needs m to be held
+  void reserve(uint64_t bytes) {
+    reserved+=bytes;
+    peak=std::max(peak,reserved);
+  }
+}
+
+namespace memory_budget {
+
+  void set_limit(uint64_t bytes) {
+    plock_guard g(m);
+    budget=bytes;
+    released.broadcast();
+  }
+
+  uint64_t limit() {
+    plock_guard g(m);
+    return budget;
+  }
+
+  bool try_acquire(uint64_t bytes) {
+    plock_guard g(m);
+    if(!fits(bytes))
+      return false;
+    reserve(bytes);
+    return true;
+  }
+
+  void acquire(uint64_t bytes) {
+    plock_guard g(m);
+    if(!fits(bytes)) {
+      auto start=std::chrono::steady_clock::now();
+      while(!fits(bytes))
+        released.wait(m);
+      ++waits;
+      wait_ns+=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+    }
+    reserve(bytes);
+  }
+
+  void release(uint64_t bytes) {
+    plock_guard g(m);
+    reserved-=bytes;
+    released.broadcast();
+  }
+
+  stats_t stats() {
+    plock_guard g(m);
+    return stats_t{peak,waits,wait_ns/1e6};
+  }
+}
@@ -0,0 +1,196 @@
+#ifdef _WIN32
+#include <Windows.h>
+#include <process.h>
+#elif __linux__
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include "output_file.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+  std::atomic<unsigned> tmp_counter(0);
+
+  // hidden and unique per process and file, so neither directory scans for .mp3 nor a second
+  // writer of the same output ever see it
+  string tmp_name(const string& filename) {
+    size_t slash=filename.find_last_of("/\\");
+    size_t base=slash==string::npos ? 0 : slash+1;
+#ifdef _WIN32
+    unsigned long pid=_getpid();
+#else
+    unsigned long pid=getpid();
+#endif
+    return filename.substr(0,base)+"."+filename.substr(base)+".tmp"+std::to_string(pid)+"_"
+      +std::to_string(tmp_counter++);
+  }
+}
+
+#ifdef __linux__
+output_file::output_file(const string& filename, uint64_t size_estimate)
+  : filename_(filename), tmp_filename_(tmp_name(filename)), size_(0), committed_(false), anonymous_(true) {
+  // an unnamed file in the target directory leaves nothing behind if the process dies,
+  // it gets a name only in commit(); file systems without O_TMPFILE get a named one
+  size_t slash=filename.find_last_of('/');
+  string dir=slash==string::npos ? "." : filename.substr(0,slash+1);
+  fd_=open(dir.c_str(),O_TMPFILE|O_WRONLY|O_CLOEXEC,0644);
+  if(fd_<0) {
+    anonymous_=false;
+    fd_=open(tmp_filename_.c_str(),O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,0644);
+  }
+  if(fd_<0)
+    throw runtime_error("Can't create "+filename);
+  // only a hint, file systems without fallocate simply grow the file
+  if(size_estimate>0)
+    fallocate(fd_,0,0,size_estimate);
+}
+
+void output_file::close_file() {
+  if(fd_>=0)
+    close(fd_);
+  fd_=-1;
+}
+
+void output_file::write(const void* data, size_t size) {
+  write_at(data,size,size_);
+  size_+=size;
+}
+
+void output_file::write_at(const void* data, size_t size, uint64_t offset) {
+  const uint8_t* p=(const uint8_t*)data;
+  while(size) {
+    ssize_t n=pwrite(fd_,p,size,offset);
+    if(n<=0)
+      throw runtime_error("Can't write "+filename_);
+    p+=n;
+    offset+=n;
+    size-=n;
+  }
+}
+
+void output_file::write(const std::vector<std::vector<uint8_t>>& chunks) {
+  std::vector<iovec> iov;
+  for(const std::vector<uint8_t>& c:chunks)
+    if(!c.empty())
+      iov.push_back(iovec{(void*)c.data(),c.size()});
+  size_t first=0;
+  while(first<iov.size()) {
+    int count=(int)std::min<size_t>(iov.size()-first,IOV_MAX);
+    ssize_t n=pwritev(fd_,&iov[first],count,size_);
+    if(n<=0)
+      throw runtime_error("Can't write "+filename_);
+    size_+=n;
+    // skip what was written, a short write leaves a partial chunk at the front
+    while(first<iov.size() && (size_t)n>=iov[first].iov_len)
+      n-=iov[first++].iov_len;
+    if(n>0) {
+      iov[first].iov_base=(uint8_t*)iov[first].iov_base+n;
+      iov[first].iov_len-=n;
+    }
+  }
+}
+
+void output_file::sync() {
+  if(ftruncate(fd_,size_)!=0 || fsync(fd_)!=0)
+    throw runtime_error("Can't write "+filename_);
+}
+
+void output_file::sync_directory(const string& dirname) {
+  string dir=dirname.empty() ? "." : dirname;
+  int fd=open(dir.c_str(),O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+  if(fd<0)
+    throw runtime_error("Can't open directory "+dir);
+  bool ok=fsync(fd)==0;
+  close(fd);
+  if(!ok)
+    throw runtime_error("Can't sync directory "+dir);
+}
+
+void output_file::commit() {
+  bool ok=ftruncate(fd_,size_)==0;
+  if(anonymous_) {
+    // linkat can't replace an existing file, so the name is the temporary one
+    string fd_path="/proc/self/fd/"+std::to_string(fd_);
+    ok=ok && linkat(AT_FDCWD,fd_path.c_str(),AT_FDCWD,tmp_filename_.c_str(),AT_SYMLINK_FOLLOW)==0;
+  }
+  ok=close(fd_)==0 && ok;
+  fd_=-1;
+  if(!ok || rename(tmp_filename_.c_str(),filename_.c_str())!=0)
+    throw runtime_error("Can't write "+filename_);
+  committed_=true;
+}
+#else
+output_file::output_file(const string& filename, uint64_t)
+  : filename_(filename), tmp_filename_(tmp_name(filename)), size_(0), committed_(false) {
+  file_=std::fopen(tmp_filename_.c_str(),"wb");
+  if(!file_)
+    throw runtime_error("Can't create "+filename);
+}
+
+void output_file::close_file() {
+  if(file_)
+    std::fclose((std::FILE*)file_);
+  file_=nullptr;
+}
+
+void output_file::write(const void* data, size_t size) {
+  write_at(data,size,size_);
+  size_+=size;
+}
+
+void output_file::write_at(const void* data, size_t size, uint64_t offset) {
+  std::FILE* f=(std::FILE*)file_;
+  if(std::fseek(f,(long)offset,SEEK_SET)!=0 || std::fwrite(data,1,size,f)!=size)
+    throw runtime_error("Can't write "+filename_);
+}
+
+void output_file::write(const std::vector<std::vector<uint8_t>>& chunks) {
+  for(const std::vector<uint8_t>& c:chunks)
+    write(c.data(),c.size());
+}
+
+void output_file::sync() {
+  if(std::fflush((std::FILE*)file_)!=0)
+    throw runtime_error("Can't write "+filename_);
+}
+
+// directory entries can't be flushed through stdio
+void output_file::sync_directory(const string&) {}
+
+void output_file::commit() {
+  bool ok=std::fclose((std::FILE*)file_)==0;
+  file_=nullptr;
+#ifdef _WIN32
+  // rename doesn't replace existing files here, MoveFileEx does so without a moment in which
+  // the output is missing
+  ok=ok && MoveFileExA(tmp_filename_.c_str(),filename_.c_str(),MOVEFILE_REPLACE_EXISTING);
+#else
+  ok=ok && std::rename(tmp_filename_.c_str(),filename_.c_str())==0;
+#endif
+  if(!ok)
+    throw runtime_error("Can't write "+filename_);
+  committed_=true;
+}
+#endif
+
+output_file::~output_file() {
+  if(committed_)
+    return;
+  close_file();
+  std::remove(tmp_filename_.c_str());
+}
+
+uint64_t output_file::size() const {
+  return size_;
+}
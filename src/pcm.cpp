@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "pcm.h"
+#include "wav.h"
+
+namespace {
+  using std::runtime_error;
+
+  template<typename F>
+  void deinterleave(const uint8_t* src, unsigned block_sz, unsigned num_channels,
+                    float* const* dst, size_t num_frames, float gain, F sample) {
+    size_t frame_sz=block_sz*num_channels;
+    for(unsigned c=0;c<num_channels;++c) {
+      const uint8_t* in=src+c*block_sz;
+      float* out=dst[c];
+      for(size_t i=0;i<num_frames;++i)
+        out[i]=sample(in+i*frame_sz)*gain;
+    }
+  }
+
+  struct g711_table {
+    float v[256];
+    explicit g711_table(short (*decode)(uint8_t)) {
+      for(int i=0;i<256;++i)
+        v[i]=decode((uint8_t)i)*(1.0f/32768);
+    }
+  };
+
+  struct g711_linear_table {
+    short v[256];
+    explicit g711_linear_table(short (*decode)(uint8_t)) {
+      for(int i=0;i<256;++i)
+        v[i]=decode((uint8_t)i);
+    }
+  };
+}
+
+namespace pcm {
+
+  void decode_alaw(const uint8_t* src, short* dst, size_t num_samples) {
+    static const g711_linear_table alaw(alaw_sample);
+    for(size_t i=0;i<num_samples;++i)
+      dst[i]=alaw.v[src[i]];
+  }
+
+  void decode_ulaw(const uint8_t* src, short* dst, size_t num_samples) {
+    static const g711_linear_table ulaw(ulaw_sample);
+    for(size_t i=0;i<num_samples;++i)
+      dst[i]=ulaw.v[src[i]];
+  }
+
+  // https://en.wikipedia.org/wiki/G.711#A-Law
+  short alaw_sample(uint8_t in) {
+    short ix = (short)in ^ (0x0055); // invert even bits
+    short mantissa = ix & 0x000F;
+    short exponent = (ix >> 4) & ~(1 << 3);
+    mantissa += (exponent > 0) ? (1 << 4) : 0;
+    mantissa = (mantissa << 4) + (0x0008);
+    mantissa = (exponent > 0) ? mantissa << (exponent - 1) : mantissa;
+    short sgn = 1 - 2 * (!!(ix & (1 << 7)));
+    return sgn * mantissa;
+  }
+
+  // https://en.wikipedia.org/wiki/G.711#%CE%BC-Law
+  short ulaw_sample(uint8_t in) {
+    short ix = (short)(in ^ 0xFF); // invert all bits
+    short mantissa = ix & 0x000F;
+    short exponent = (ix >> 4) & ~(1 << 3);
+    short sgn = 1 - 2 * ((ix & (1 << 7)) != 0);
+    mantissa <<= (exponent + 1);
+    return sgn * ((mantissa + (33 << exponent) - 33) << (sizeof(short) * 8 - 14));
+  }
+
+  void to_float(const uint8_t* src, uint32_t format_code, unsigned block_sz, unsigned num_channels,
+                float* const* dst, size_t num_frames, float gain) {
+    if(format_code==wav::WAVE_FORMAT_PCM) {
+      if(block_sz==1)
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            return (p[0]-128)*(1.0f/128); });
+      else if(block_sz==2)
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            return (int16_t)(p[0] | p[1]<<8)*(1.0f/32768); });
+      else if(block_sz==3)
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            return (int32_t)((uint32_t)p[0]<<8 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<24)*(1.0f/2147483648.0f); });
+      else if(block_sz==4)
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            return (int32_t)(p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24)*(1.0f/2147483648.0f); });
+      else
+        throw runtime_error("Sample containers too big");
+    }
+    else if(format_code==wav::WAVE_FORMAT_IEEE_FLOAT) {
+      if(block_sz==sizeof(float))
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            uint32_t u=p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+            float f;
+            memcpy(&f,&u,sizeof(f));
+            return f; });
+      else if(block_sz==sizeof(double))
+        deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+            uint64_t u=0;
+            for(int i=7;i>=0;--i)
+              u=u<<8 | p[i];
+            double d;
+            memcpy(&d,&u,sizeof(d));
+            return (float)d; });
+      else
+        throw runtime_error("Wrong sample width for float PCM");
+    }
+    else if(format_code==wav::WAVE_FORMAT_ALAW) {
+      static const g711_table alaw(alaw_sample);
+      deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+          return alaw.v[p[0]]; });
+    }
+    else if(format_code==wav::WAVE_FORMAT_MULAW) {
+      static const g711_table ulaw(ulaw_sample);
+      deinterleave(src,block_sz,num_channels,dst,num_frames,gain,[](const uint8_t* p) {
+          return ulaw.v[p[0]]; });
+    }
+    else
+      throw runtime_error("Unsupported format");
+  }
+
+  // 8 independent maxima, so the loop vectorizes without relaxing float semantics
+  float peak(const float* __restrict samples, size_t num_samples) {
+    float m[8]={0,0,0,0,0,0,0,0};
+    size_t i=0;
+    for(;i+8<=num_samples;i+=8)
+      for(unsigned j=0;j<8;++j) {
+        float a=std::fabs(samples[i+j]);
+        m[j]=a>m[j] ? a : m[j];
+      }
+    float r=0;
+    for(unsigned j=0;j<8;++j)
+      r=std::max(r,m[j]);
+    for(;i<num_samples;++i)
+      r=std::max(r,std::fabs(samples[i]));
+    return r;
+  }
+
+  void clip(float* samples, size_t num_samples) {
+    for(size_t i=0;i<num_samples;++i)
+      samples[i]=samples[i]>1 ? 1 : (samples[i]<-1 ? -1 : samples[i]);
+  }
+}
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include "prefetch.h"
+#include "util.h"
+
+namespace {
+  using clock = std::chrono::steady_clock;
+
+  std::atomic<uint64_t> loaded(0);
+  std::atomic<uint64_t> bytes(0);
+  std::atomic<uint64_t> hinted(0);
+  std::atomic<uint64_t> depth_sum(0);
+  std::atomic<uint64_t> depth_samples(0);
+  std::atomic<uint64_t> worker_waits(0);
+  std::atomic<uint64_t> worker_wait_ns(0);
+  std::atomic<uint64_t> reader_waits(0);
+  std::atomic<uint64_t> reader_wait_ns(0);
+
+  uint64_t ns_since(clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-start).count();
+  }
+}
+
+namespace prefetch {
+  using namespace pthread_raii;
+
+  reader::reader(std::vector<std::string> filenames, unsigned num_threads, size_t depth, size_t max_bytes)
+    : filenames_(std::move(filenames)), depth_(std::max<size_t>(1,depth)), max_bytes_(std::max<size_t>(1,max_bytes)),
+      queued_bytes_(0), reading_(0), claimed_(0), handed_out_(0), stopping_(false) {
+    threads_.reserve(num_threads);
+    for(unsigned i=0;i<std::max(1u,num_threads);++i)
+      threads_.emplace_back(thread_options("prefetch-"+std::to_string(i)),[this]() { read_ahead(); });
+  }
+
+  reader::~reader() {
+    {
+      plock_guard g(m_);
+      stopping_=true;
+      room_.broadcast();
+    }
+    threads_.clear();
+  }
+
+  void reader::read_ahead() {
+    while(true) {
+      input in;
+      {
+        plock_guard g(m_);
+        if(stopping_ || claimed_==filenames_.size())
+          return;
+        in.filename=filenames_[claimed_++];
+      }
+      // files beyond the memory bound are left to the page cache
+      uint64_t size=util::file_size(in.filename);
+      if(size>max_bytes_)
+        size=0;
+      {
+        plock_guard g(m_);
+        // room for one more input, and for its data unless nothing else is held
+        auto full=[&]() {
+          return queue_.size()+reading_>=depth_ || (size>0 && queued_bytes_>0 && queued_bytes_+size>max_bytes_);
+        };
+        if(full() && !stopping_) {
+          auto start=clock::now();
+          while(full() && !stopping_)
+            room_.wait(m_);
+          ++reader_waits;
+          reader_wait_ns+=ns_since(start);
+        }
+        if(stopping_)
+          return;
+        ++reading_;
+        queued_bytes_+=size;
+      }
+
+      in.loaded=size>0 && util::read_small_file(in.filename,in.data,max_bytes_);
+      if(in.loaded) {
+        ++loaded;
+        bytes+=in.data.size();
+      }
+      else {
+        in.data.clear();
+        util::read_ahead(in.filename);
+        ++hinted;
+      }
+
+      plock_guard g(m_);
+      --reading_;
+      // the file may have changed size since it was looked at
+      queued_bytes_=queued_bytes_-size+in.data.size();
+      queue_.push_back(std::move(in));
+      ready_.signal();
+    }
+  }
+
+  bool reader::next(input& in) {
+    plock_guard g(m_);
+    depth_sum+=queue_.size();
+    ++depth_samples;
+    if(queue_.empty() && handed_out_<filenames_.size()) {
+      auto start=clock::now();
+      while(queue_.empty() && handed_out_<filenames_.size())
+        ready_.wait(m_);
+      ++worker_waits;
+      worker_wait_ns+=ns_since(start);
+    }
+    if(queue_.empty())
+      return false;
+    in=std::move(queue_.front());
+    queue_.pop_front();
+    queued_bytes_-=in.data.size();
+    // the last input lets every other waiting worker see that there is nothing left
+    if(++handed_out_==filenames_.size())
+      ready_.broadcast();
+    room_.broadcast();
+    return true;
+  }
+
+  size_t reader::remaining() {
+    plock_guard g(m_);
+    return filenames_.size()-handed_out_;
+  }
+
+  stats_t stats() {
+    uint64_t samples=depth_samples;
+    return stats_t{loaded.load(),bytes.load(),hinted.load(),samples ? (double)depth_sum/samples : 0,
+                   worker_waits.load(),worker_wait_ns/1e6,reader_waits.load(),reader_wait_ns/1e6};
+  }
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "buffer_pool.h"
+#include "resample.h"
+
+namespace {
+  using std::runtime_error;
+
+  struct preset {
+    // stopband attenuation in dB
+    double attenuation;
+    // passband and stopband edge relative to the lower Nyquist frequency,
+    // a stopband edge above 1 lets the transition band alias above the passband
+    double pass;
+    double stop;
+  };
+
+  // indexed by resample::quality
+  const preset presets[] = {
+    {50, 0.80, 1.20},
+    {80, 0.85, 1.00},
+    {100, 0.91, 1.00}
+  };
+
+  // the filter bank holds up*taps coefficients
+  const size_t max_bank_size=size_t(1)<<22;
+
+  unsigned gcd(unsigned a, unsigned b) {
+    while(b) {
+      unsigned t=a%b;
+      a=b;
+      b=t;
+    }
+    return a;
+  }
+
+  double bessel_i0(double x) {
+    double sum=1, term=1;
+    for(int k=1;k<50 && term>1e-12*sum;++k) {
+      term*=(x/(2*k))*(x/(2*k));
+      sum+=term;
+    }
+    return sum;
+  }
+
+  // taps is a multiple of 8, the 8 independent partial sums let the compiler vectorize
+  // without reassociating the additions
+  float dot(const float* __restrict h, const float* __restrict x, unsigned taps) {
+    float acc[8]={0,0,0,0,0,0,0,0};
+    for(unsigned k=0;k<taps;k+=8)
+      for(unsigned j=0;j<8;++j)
+        acc[j]+=h[k+j]*x[k+j];
+    return ((acc[0]+acc[4])+(acc[1]+acc[5]))+((acc[2]+acc[6])+(acc[3]+acc[7]));
+  }
+}
+
+namespace resample {
+
+  quality parse_quality(const std::string& s) {
+    if(s=="low")
+      return quality::low;
+    if(s=="medium")
+      return quality::medium;
+    if(s=="high")
+      return quality::high;
+    throw runtime_error("Unknown resampling quality "+s);
+  }
+
+  resampler::resampler(unsigned rate_in, unsigned rate_out, quality q) {
+    if(rate_in==0 || rate_out==0)
+      throw runtime_error("Invalid sample rate");
+    unsigned g=gcd(rate_in,rate_out);
+    up_=rate_out/g;
+    down_=rate_in/g;
+    const preset& p=presets[(int)q];
+
+    // Kaiser's design formulas, frequencies in cycles per input sample
+    double nyquist=0.5*std::min(1.0,(double)up_/down_);
+    double transition=(p.stop-p.pass)*nyquist;
+    double cutoff=(p.pass+p.stop)/2*nyquist;
+    double beta=p.attenuation>50 ? 0.1102*(p.attenuation-8.7)
+      : 0.5842*std::pow(p.attenuation-21,0.4)+0.07886*(p.attenuation-21);
+    taps_=(unsigned)std::ceil((p.attenuation-8)/(14.36*transition));
+    taps_=(taps_+7)/8*8;
+    if((size_t)up_*taps_>max_bank_size)
+      throw runtime_error("Unsupported resampling ratio");
+
+    double half=taps_/2.0;
+    const double pi=3.14159265358979323846;
+    bank_.resize((size_t)up_*taps_);
+    for(unsigned ph=0;ph<up_;++ph) {
+      float* h=&bank_[(size_t)ph*taps_];
+      double sum=0;
+      for(unsigned k=0;k<taps_;++k) {
+        // distance of the output position to the input sample under tap k
+        double tau=(double)ph/up_+half-1-k;
+        double r=tau/half;
+        double window=r*r<1 ? bessel_i0(beta*std::sqrt(1-r*r))/bessel_i0(beta) : 0;
+        double x=2*pi*cutoff*tau;
+        double v=(tau==0 ? 1 : std::sin(x)/x)*window;
+        h[k]=(float)v;
+        sum+=v;
+      }
+      // unity gain at DC for every phase
+      for(unsigned k=0;k<taps_;++k)
+        h[k]=(float)(h[k]/sum);
+    }
+  }
+
+  size_t resampler::output_frames(size_t num_in) const {
+    return (num_in*up_+down_-1)/down_;
+  }
+
+  void resampler::process(const float* in, size_t num_in, float* out) const {
+    // zero padded copy, so taps never leave the buffer
+    size_t half=taps_/2;
+    buffer_pool::buffer padded((num_in+taps_)*sizeof(float));
+    float* x=(float*)padded.get();
+    std::fill(x,x+half,0.0f);
+    memcpy(x+half,in,num_in*sizeof(float));
+    std::fill(x+half+num_in,x+num_in+taps_,0.0f);
+
+    size_t num_out=output_frames(num_in);
+    size_t step=down_/up_;
+    unsigned step_phase=down_%up_;
+    size_t n0=0;
+    unsigned ph=0;
+    for(size_t j=0;j<num_out;++j) {
+      // taps cover in[n0-half+1 .. n0+half]
+      out[j]=dot(&bank_[(size_t)ph*taps_],x+n0+1,taps_);
+      n0+=step;
+      ph+=step_phase;
+      if(ph>=up_) {
+        ph-=up_;
+        ++n0;
+      }
+    }
+  }
+}
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+#include "segment.h"
+
+namespace {
+  using std::runtime_error;
+
+  // layer III bitrates in kbps, MPEG 1 and MPEG 2 / 2.5
+  const unsigned bitrates[2][15]={
+    {0,32,40,48,56,64,80,96,112,128,160,192,224,256,320},
+    {0,8,16,24,32,40,48,56,64,80,96,112,128,144,160}
+  };
+  const unsigned sample_rates[3]={44100,48000,32000};
+
+  const size_t header_size=4;
+}
+
+namespace segment {
+
+  size_t frame_size(const uint8_t* h) {
+    if(h[0]!=0xff || (h[1]&0xe0)!=0xe0)
+      return 0;
+    unsigned version=(h[1]>>3)&3;
+    unsigned layer=(h[1]>>1)&3;
+    unsigned bitrate_index=h[2]>>4;
+    unsigned rate_index=(h[2]>>2)&3;
+    unsigned padding=(h[2]>>1)&1;
+    // version 1 is reserved, layer 1 means layer III
+    if(version==1 || layer!=1 || bitrate_index==0 || bitrate_index==15 || rate_index==3)
+      return 0;
+    bool mpeg1=version==3;
+    unsigned bitrate=bitrates[mpeg1 ? 0 : 1][bitrate_index]*1000;
+    unsigned sample_rate=sample_rates[rate_index]>>(mpeg1 ? 0 : version==2 ? 1 : 2);
+    return (mpeg1 ? 144 : 72)*bitrate/sample_rate+padding;
+  }
+
+  writer::writer(const std::string& name, double segment_seconds, unsigned sample_rate, unsigned frame_samples)
+    : name_(name), frame_seconds_((double)frame_samples/sample_rate), frames_in_segment_(0) {
+    frames_per_segment_=std::max(1u,(unsigned)std::lround(segment_seconds/frame_seconds_));
+  }
+
+  void writer::prefix(const uint8_t* data, size_t size) {
+    prefix_.assign(data,data+size);
+  }
+
+  // frames are constant in size apart from padding, so the first one tells the segment size
+  void writer::open_segment(size_t frame_size) {
+    char index[16];
+    snprintf(index,sizeof(index),"_%05u.mp3",(unsigned)segment_frames_.size());
+    size_t prefix_size=segment_frames_.empty() ? prefix_.size() : 0;
+    file_.reset(new output_file(name_+index,prefix_size+(uint64_t)frames_per_segment_*(frame_size+1)));
+    file_->write(prefix_.data(),prefix_size);
+  }
+
+  void writer::close_segment() {
+    file_->commit();
+    file_.reset();
+    segment_frames_.push_back(frames_in_segment_);
+    frames_in_segment_=0;
+    write_playlist(false);
+  }
+
+  void writer::write(const uint8_t* data, size_t size) {
+    pending_.insert(pending_.end(),data,data+size);
+    size_t pos=0;
+    while(pending_.size()-pos>=header_size) {
+      size_t n=frame_size(&pending_[pos]);
+      if(n==0)
+        throw runtime_error("Lost frame sync while segmenting");
+      if(pending_.size()-pos<n)
+        break;
+      if(!file_)
+        open_segment(n);
+      file_->write(&pending_[pos],n);
+      pos+=n;
+      if(++frames_in_segment_==frames_per_segment_)
+        close_segment();
+    }
+    pending_.erase(pending_.begin(),pending_.begin()+pos);
+  }
+
+  void writer::finish() {
+    if(!pending_.empty())
+      throw runtime_error("Incomplete frame at the end of the stream");
+    if(file_)
+      close_segment();
+    write_playlist(true);
+  }
+
+  void writer::write_playlist(bool complete) {
+    // the base name without directories, segments sit next to the playlist
+    std::string base=name_.substr(name_.find_last_of("/\\")+1);
+    // segment durations rounded to the nearest second must not exceed the target
+    unsigned target=std::max(1u,(unsigned)std::lround(frames_per_segment_*frame_seconds_));
+    std::ostringstream playlist;
+    playlist<<"#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:"<<target
+            <<"\n#EXT-X-MEDIA-SEQUENCE:0\n#EXT-X-PLAYLIST-TYPE:EVENT\n";
+    char line[64];
+    for(size_t i=0;i<segment_frames_.size();++i) {
+      snprintf(line,sizeof(line),"#EXTINF:%.3f,\n",segment_frames_[i]*frame_seconds_);
+      playlist<<line;
+      snprintf(line,sizeof(line),"_%05u.mp3\n",(unsigned)i);
+      playlist<<base<<line;
+    }
+    if(complete)
+      playlist<<"#EXT-X-ENDLIST\n";
+    // replaced by rename, so players never read a half written playlist
+    std::string text=playlist.str();
+    output_file out(name_+".m3u8",text.size());
+    out.write(text.data(),text.size());
+    out.commit();
+  }
+}
@@ -0,0 +1,286 @@
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <memory>
+#include <stdexcept>
+#include "pthread_raii.h"
+#include "server.h"
+#include "worker_pool.h"
+
+using std::runtime_error;
+using std::string;
+
+#ifdef __linux__
+namespace {
+  using namespace pthread_raii;
+
+  volatile sig_atomic_t stop_requested=0;
+
+  void request_stop(int) {
+    stop_requested=1;
+  }
+
+  bool read_all(int fd, void* buf, size_t size) {
+    uint8_t* p=(uint8_t*)buf;
+    while(size) {
+      ssize_t n=::read(fd,p,size);
+      if(n<0 && errno==EINTR)
+        continue;
+      if(n<=0)
+        return false;
+      p+=n;
+      size-=n;
+    }
+    return true;
+  }
+
+  bool write_all(int fd, const void* buf, size_t size) {
+    const uint8_t* p=(const uint8_t*)buf;
+    while(size) {
+      // a client that went away must not kill the daemon with SIGPIPE
+      ssize_t n=::send(fd,p,size,MSG_NOSIGNAL);
+      if(n<0 && errno==EINTR)
+        continue;
+      if(n<=0)
+        return false;
+      p+=n;
+      size-=n;
+    }
+    return true;
+  }
+
+  sockaddr_un socket_address(const string& path) {
+    sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family=AF_UNIX;
+    if(path.size()>=sizeof(addr.sun_path))
+      throw runtime_error("Socket path too long: "+path);
+    strcpy(addr.sun_path,path.c_str());
+    return addr;
+  }
+
+  // responses of the workers and the reader thread are queued and sent by a writer thread, so
+  // neither blocks on a client that doesn't read its responses
+  class connection {
+  public:
+    //! the request reader waits while this many responses are queued
+    static const size_t max_queued=256;
+
+    explicit connection(int fd)
+      : fd_(fd), closing_(false), broken_(false) {
+      // a client that stops reading for this long is given up, it would hold up whoever drops the
+      // last reference to the connection
+      timeval timeout={30,0};
+      setsockopt(fd_,SOL_SOCKET,SO_SNDTIMEO,&timeout,sizeof(timeout));
+      writer_.reset(new pthread(thread_options("session writer"),[this]() { write(); }));
+    }
+    connection(const connection& other) = delete;
+    ~connection() {
+      {
+        plock_guard g(m_);
+        closing_=true;
+        not_empty_.signal();
+      }
+      // the queued responses are sent before the socket is closed
+      writer_.reset();
+      close(fd_);
+    }
+    int fd() const {
+      return fd_;
+    }
+    void send(const string& payload) {
+      plock_guard g(m_);
+      if(broken_)
+        return;
+      queue_.push_back(payload);
+      not_empty_.signal();
+    }
+    //! blocks while max_queued responses wait for the client
+    void wait_for_room() {
+      plock_guard g(m_);
+      while(queue_.size()>=max_queued && !broken_)
+        not_full_.wait(m_);
+    }
+  private:
+    void write() {
+      while(true) {
+        string payload;
+        {
+          plock_guard g(m_);
+          while(queue_.empty() && !closing_)
+            not_empty_.wait(m_);
+          if(queue_.empty())
+            return;
+          payload=std::move(queue_.front());
+          queue_.pop_front();
+          not_full_.signal();
+        }
+        if(!server::write_frame(fd_,payload)) {
+          // the client went away, its remaining responses are dropped
+          plock_guard g(m_);
+          broken_=true;
+          queue_.clear();
+          not_full_.signal();
+          return;
+        }
+      }
+    }
+
+    int fd_;
+    pmutex m_;
+    pcond not_empty_;
+    pcond not_full_;
+    std::deque<string> queue_;
+    bool closing_;
+    bool broken_;
+    std::unique_ptr<pthread> writer_;
+  };
+
+  // reads the requests of one client, jobs keep the connection alive until they are answered
+  class session {
+  public:
+    session(int fd, worker_pool::pool& workers)
+      : conn_(std::make_shared<connection>(fd)), workers_(workers), done_(false), reader_(thread_options("session"),[this]() { read(); }) {}
+    bool done() const {
+      return done_;
+    }
+    void stop() {
+      shutdown(conn_->fd(),SHUT_RD);
+    }
+  private:
+    void read() {
+      string payload;
+      // no more requests are read while the client lags behind with reading the responses
+      while(server::read_frame(conn_->fd(),payload)) {
+        size_t a=payload.find('\n');
+        size_t b=a==string::npos ? a : payload.find('\n',a+1);
+        string id=payload.substr(0,a);
+        if(b==string::npos)
+          conn_->send(id+" ERR malformed request");
+        else {
+          std::shared_ptr<connection> conn=conn_;
+          worker_pool::job j{payload.substr(a+1,b-a-1),payload.substr(b+1),
+            [conn,id](const worker_pool::result& r) {
+              char timings[64];
+              snprintf(timings,sizeof(timings)," %.3f %.3f",r.queued_ms,r.convert_ms);
+              conn->send(r.ok ? id+" OK"+timings : id+" ERR "+r.error);
+            }};
+          if(!workers_.try_submit(std::move(j)))
+            conn_->send(id+" BUSY");
+        }
+        conn_->wait_for_room();
+      }
+      done_=true;
+    }
+
+    std::shared_ptr<connection> conn_;
+    worker_pool::pool& workers_;
+    std::atomic<bool> done_;
+    // last member, joined before the others are destroyed
+    pthread reader_;
+  };
+}
+#endif
+
+namespace server {
+
+#ifdef __linux__
+  bool read_frame(int fd, string& payload) {
+    uint8_t len[4];
+    if(!read_all(fd,len,4))
+      return false;
+    size_t size=len[0] | len[1]<<8 | len[2]<<16 | (size_t)len[3]<<24;
+    if(size>max_frame)
+      return false;
+    payload.resize(size);
+    return read_all(fd,&payload[0],size);
+  }
+
+  bool write_frame(int fd, const string& payload) {
+    if(payload.size()>max_frame)
+      return false;
+    uint8_t len[4]={(uint8_t)payload.size(),(uint8_t)(payload.size()>>8),(uint8_t)(payload.size()>>16),
+                    (uint8_t)(payload.size()>>24)};
+    return write_all(fd,len,4) && write_all(fd,payload.data(),payload.size());
+  }
+
+  int connect(const string& socket_path) {
+    sockaddr_un addr=socket_address(socket_path);
+    int fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if(fd<0 || ::connect(fd,(sockaddr*)&addr,sizeof(addr))<0) {
+      if(fd>=0)
+        close(fd);
+      throw runtime_error("Can't connect to "+socket_path+": "+strerror(errno));
+    }
+    return fd;
+  }
+
+  void serve(const string& socket_path, const convert::settings& s, unsigned num_workers,
+             size_t queue_capacity) {
+    sockaddr_un addr=socket_address(socket_path);
+    int listen_fd=socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+    if(listen_fd<0)
+      throw runtime_error(string("Can't create socket: ")+strerror(errno));
+    unlink(socket_path.c_str());
+    if(bind(listen_fd,(sockaddr*)&addr,sizeof(addr))<0 || listen(listen_fd,SOMAXCONN)<0) {
+      close(listen_fd);
+      throw runtime_error("Can't listen on "+socket_path+": "+strerror(errno));
+    }
+
+    // no SA_RESTART, so poll returns when a signal arrives
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler=request_stop;
+    sigaction(SIGINT,&sa,nullptr);
+    sigaction(SIGTERM,&sa,nullptr);
+
+    {
+      // destroyed after the sessions, so jobs still queued are finished and answered
+      worker_pool::pool workers(s,num_workers,queue_capacity);
+      std::list<std::unique_ptr<session>> sessions;
+      while(!stop_requested) {
+        pollfd p={listen_fd,POLLIN,0};
+        int ready=poll(&p,1,1000);
+        sessions.remove_if([](const std::unique_ptr<session>& sn) { return sn->done(); });
+        if(ready<=0)
+          continue;
+        int fd=accept4(listen_fd,nullptr,nullptr,SOCK_CLOEXEC);
+        if(fd>=0)
+          sessions.emplace_back(new session(fd,workers));
+      }
+      for(auto& sn:sessions)
+        sn->stop();
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+  }
+#else
+  bool read_frame(int, string&) {
+    return false;
+  }
+
+  bool write_frame(int, const string&) {
+    return false;
+  }
+
+  int connect(const string&) {
+    throw runtime_error("Daemon mode is only supported on Linux");
+  }
+
+  void serve(const string&, const convert::settings&, unsigned, size_t) {
+    throw runtime_error("Daemon mode is only supported on Linux");
+  }
+#endif
+}
@@ -0,0 +1,378 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include "pthread_raii.h"
+#include "tar.h"
+#include "util.h"
+#include "wav2mp3.h"
+
+using std::runtime_error;
+using std::string;
+
+namespace {
+  using namespace pthread_raii;
+
+  // field offsets and lengths of the ustar header
+  const size_t name_off=0, name_len=100;
+  const size_t mode_off=100, mode_len=8;
+  const size_t uid_off=108, gid_off=116, id_len=8;
+  const size_t size_off=124, size_len=12;
+  const size_t mtime_off=136, mtime_len=12;
+  const size_t chksum_off=148, chksum_len=8;
+  const size_t type_off=156;
+  const size_t magic_off=257;
+  const size_t prefix_off=345, prefix_len=155;
+
+  const string long_link_name="././@LongLink";
+
+  uint64_t padded(uint64_t size) {
+    return (size+tar::block_size-1)/tar::block_size*tar::block_size;
+  }
+
+  string field(const char* block, size_t off, size_t len) {
+    const char* p=block+off;
+    return string(p,std::find(p,p+len,'\0'));
+  }
+
+  // octal, or base-256 big endian when the high bit of the first byte is set
+  uint64_t parse_number(const char* block, size_t off, size_t len) {
+    const uint8_t* p=(const uint8_t*)block+off;
+    uint64_t v=0;
+    if(p[0]&0x80) {
+      v=p[0]&0x7f;
+      for(size_t i=1;i<len;++i)
+        v=(v<<8)|p[i];
+      return v;
+    }
+    size_t i=0;
+    while(i<len && p[i]==' ')
+      ++i;
+    for(;i<len && p[i]>='0' && p[i]<='7';++i)
+      v=v*8+(p[i]-'0');
+    return v;
+  }
+
+  void put_number(char* block, size_t off, size_t len, uint64_t v) {
+    // len-1 octal digits and a terminating NUL if it fits, base-256 otherwise
+    if(len-1<22 && v>>(3*(len-1))) {
+      for(size_t i=len;i-->1;v>>=8)
+        block[off+i]=(char)(v&0xff);
+      block[off]=(char)0x80;
+      return;
+    }
+    snprintf(block+off,len,"%0*llo",(int)len-1,(unsigned long long)v);
+  }
+
+  unsigned checksum(const char* block) {
+    unsigned sum=0;
+    for(size_t i=0;i<tar::block_size;++i)
+      sum+=i>=chksum_off && i<chksum_off+chksum_len ? ' ' : (uint8_t)block[i];
+    return sum;
+  }
+
+  bool zero_block(const char* block) {
+    for(size_t i=0;i<tar::block_size;++i)
+      if(block[i])
+        return false;
+    return true;
+  }
+
+  // pax records are "<length> <key>=<value>\n"
+  void parse_pax(const std::vector<uint8_t>& data, string& path, uint64_t& size, bool& has_size) {
+    string s(data.begin(),data.end());
+    size_t pos=0;
+    while(pos<s.size()) {
+      size_t space=s.find(' ',pos);
+      if(space==string::npos)
+        break;
+      size_t len=std::strtoull(s.c_str()+pos,nullptr,10);
+      if(len==0 || pos+len>s.size())
+        throw runtime_error("Invalid pax header");
+      string record=s.substr(space+1,pos+len-space-2);
+      size_t eq=record.find('=');
+      if(eq!=string::npos) {
+        string key=record.substr(0,eq);
+        if(key=="path")
+          path=record.substr(eq+1);
+        else if(key=="size") {
+          size=std::strtoull(record.c_str()+eq+1,nullptr,10);
+          has_size=true;
+        }
+      }
+      pos+=len;
+    }
+  }
+
+  bool ends_with_wav(const string& name) {
+    return name.size()>=4 && util::string_to_lower(name.substr(name.size()-4))==".wav";
+  }
+
+  // one WAV member on its way through the workers
+  struct slot {
+    tar::member m;
+    std::vector<uint8_t> wav;
+    std::vector<uint8_t> mp3;
+    string error;
+    bool done;
+  };
+
+  class pipeline {
+  public:
+    pipeline(const convert::settings& s, unsigned num_workers) : settings_(s), stopping_(false) {
+      threads_.reserve(num_workers);
+      for(unsigned i=0;i<num_workers;++i)
+        threads_.emplace_back(util::worker_thread("worker",i),[this]() { work(); });
+    }
+    pipeline(const pipeline& other) = delete;
+    ~pipeline() {
+      {
+        plock_guard g(m_);
+        stopping_=true;
+        not_empty_.broadcast();
+      }
+      threads_.clear();
+    }
+    void submit(const std::shared_ptr<slot>& sl) {
+      plock_guard g(m_);
+      queue_.push_back(sl);
+      not_empty_.signal();
+    }
+    bool done(const slot& sl) {
+      plock_guard g(m_);
+      return sl.done;
+    }
+    void wait(const slot& sl) {
+      plock_guard g(m_);
+      while(!sl.done)
+        finished_.wait(m_);
+    }
+  private:
+    void work() {
+      wav2mp3::converter c(settings_);
+      while(true) {
+        std::shared_ptr<slot> sl;
+        {
+          plock_guard g(m_);
+          while(queue_.empty() && !stopping_)
+            not_empty_.wait(m_);
+          if(queue_.empty())
+            return;
+          sl=queue_.front();
+          queue_.pop_front();
+        }
+        try {
+          c.convert(sl->wav.data(),sl->wav.size(),
+                    [&sl](const uint8_t* data, size_t size) { sl->mp3.assign(data,data+size); });
+        }
+        catch(std::exception& e) {
+          sl->error=e.what();
+        }
+        // only the output has to wait for its turn
+        std::vector<uint8_t>().swap(sl->wav);
+        plock_guard g(m_);
+        sl->done=true;
+        finished_.broadcast();
+      }
+    }
+
+    const convert::settings settings_;
+    pmutex m_;
+    pcond not_empty_;
+    pcond finished_;
+    std::deque<std::shared_ptr<slot>> queue_;
+    bool stopping_;
+    std::vector<pthread> threads_;
+  };
+}
+
+namespace tar {
+
+  reader::reader(std::istream& in) : in_(in), remaining_(0), size_(0) {}
+
+  bool reader::read_block(char* block) {
+    in_.read(block,block_size);
+    if(in_.gcount()==0)
+      return false;
+    if(in_.gcount()!=(std::streamsize)block_size)
+      throw runtime_error("Truncated tar archive");
+    return true;
+  }
+
+  void reader::skip(uint64_t size) {
+    char buf[65536];
+    while(size) {
+      size_t n=(size_t)std::min<uint64_t>(size,sizeof(buf));
+      in_.read(buf,n);
+      if(in_.gcount()!=(std::streamsize)n)
+        throw runtime_error("Truncated tar archive");
+      size-=n;
+    }
+  }
+
+  bool reader::next(member& m) {
+    skip(remaining_);
+    remaining_=0;
+    string long_name;
+    string pax_path;
+    uint64_t pax_size=0;
+    bool has_pax_size=false;
+    char block[block_size];
+    while(true) {
+      // an archive ends with two zero blocks, some writers only put one or none
+      if(!read_block(block) || zero_block(block))
+        return false;
+      if(parse_number(block,chksum_off,chksum_len)!=checksum(block))
+        throw runtime_error("Invalid tar header checksum");
+
+      m.name=field(block,name_off,name_len);
+      if(memcmp(block+magic_off,"ustar",5)==0) {
+        string prefix=field(block,prefix_off,prefix_len);
+        if(!prefix.empty())
+          m.name=prefix+"/"+m.name;
+      }
+      m.size=parse_number(block,size_off,size_len);
+      m.type=block[type_off] ? block[type_off] : '0';
+      m.mode=(unsigned)parse_number(block,mode_off,mode_len);
+      m.mtime=parse_number(block,mtime_off,mtime_len);
+      size_=m.size;
+      remaining_=padded(m.size);
+
+      if(m.type=='L' || m.type=='x') {
+        std::vector<uint8_t> data;
+        read(data);
+        if(m.type=='L')
+          long_name.assign(data.begin(),std::find(data.begin(),data.end(),0));
+        else
+          parse_pax(data,pax_path,pax_size,has_pax_size);
+        continue;
+      }
+      if(!long_name.empty())
+        m.name=long_name;
+      if(!pax_path.empty())
+        m.name=pax_path;
+      if(has_pax_size) {
+        m.size=size_=pax_size;
+        remaining_=padded(pax_size);
+      }
+      // hard links, symlinks and directories carry no data
+      if(m.type!='0' && m.type!='7')
+        size_=0;
+      return true;
+    }
+  }
+
+  void reader::read(std::vector<uint8_t>& data) {
+    data.resize((size_t)size_);
+    in_.read((char*)data.data(),data.size());
+    if(in_.gcount()!=(std::streamsize)data.size())
+      throw runtime_error("Truncated tar archive");
+    skip(remaining_-size_);
+    remaining_=0;
+  }
+
+  writer::writer(std::ostream& out) : out_(out) {}
+
+  void writer::header(const member& m, const string& name, const string& prefix, uint64_t size, char type) {
+    char block[block_size];
+    memset(block,0,sizeof(block));
+    memcpy(block+name_off,name.data(),std::min(name.size(),name_len));
+    put_number(block,mode_off,mode_len,m.mode);
+    put_number(block,uid_off,id_len,0);
+    put_number(block,gid_off,id_len,0);
+    put_number(block,size_off,size_len,size);
+    put_number(block,mtime_off,mtime_len,m.mtime);
+    block[type_off]=type;
+    memcpy(block+magic_off,"ustar\0" "00",8);
+    memcpy(block+prefix_off,prefix.data(),std::min(prefix.size(),prefix_len));
+    snprintf(block+chksum_off,chksum_len,"%06o",checksum(block));
+    block[chksum_off+chksum_len-1]=' ';
+    out_.write(block,sizeof(block));
+  }
+
+  void writer::pad(uint64_t size) {
+    static const char zeros[block_size]={};
+    out_.write(zeros,padded(size)-size);
+  }
+
+  void writer::add(const member& m, const uint8_t* data, size_t size) {
+    string name=m.name;
+    string prefix;
+    if(name.size()>name_len) {
+      // split into prefix and name at a slash if possible, GNU long name record otherwise
+      size_t slash=name.find('/',name.size()-name_len-1);
+      if(slash!=string::npos && slash>0 && slash<=prefix_len) {
+        prefix=name.substr(0,slash);
+        name=name.substr(slash+1);
+      }
+      else {
+        header(m,long_link_name,string(),name.size()+1,'L');
+        out_.write(name.c_str(),name.size()+1);
+        pad(name.size()+1);
+        name=name.substr(0,name_len);
+      }
+    }
+    header(m,name,prefix,size,'0');
+    out_.write((const char*)data,size);
+    pad(size);
+    if(!out_)
+      throw runtime_error("Could not write tar archive");
+  }
+
+  void writer::finish() {
+    static const char zeros[2*block_size]={};
+    out_.write(zeros,sizeof(zeros));
+    out_.flush();
+    if(!out_)
+      throw runtime_error("Could not write tar archive");
+  }
+
+  void convert(std::istream& in, std::ostream& out, const convert::settings& s, unsigned num_workers,
+               size_t window) {
+    reader r(in);
+    writer w(out);
+    std::deque<std::shared_ptr<slot>> order;
+    pipeline workers(s,std::max(1u,num_workers));
+    window=std::max<size_t>(1,window);
+
+    // the oldest member is written as soon as it is done, so output follows input order
+    auto write_front=[&]() {
+      std::shared_ptr<slot> sl=order.front();
+      order.pop_front();
+      if(!sl->error.empty()) {
+        std::cerr<<sl->m.name<<": "<<sl->error<<std::endl;
+        return;
+      }
+      sl->m.name=sl->m.name.substr(0,sl->m.name.size()-4)+".mp3";
+      w.add(sl->m,sl->mp3.data(),sl->mp3.size());
+    };
+
+    member m;
+    while(r.next(m)) {
+      if((m.type!='0' && m.type!='7') || !ends_with_wav(m.name))
+        continue;
+      while(!order.empty() && workers.done(*order.front()))
+        write_front();
+      if(order.size()>=window) {
+        workers.wait(*order.front());
+        write_front();
+      }
+      std::shared_ptr<slot> sl=std::make_shared<slot>();
+      sl->m=m;
+      sl->done=false;
+      r.read(sl->wav);
+      order.push_back(sl);
+      workers.submit(sl);
+    }
+    while(!order.empty()) {
+      workers.wait(*order.front());
+      write_front();
+    }
+    w.finish();
+  }
+}
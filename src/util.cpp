@@ -1,10 +1,18 @@
 #ifdef _WIN32
 #include <Windows.h>
 #elif __linux__
+#include <sched.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #endif
 
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
 #include <functional>
 #include <vector>
 #include <cctype>
@@ -31,9 +39,169 @@ namespace util {
   }
 #endif
 
+#ifdef _WIN32
+  vector<int> allowed_cpus() {
+    vector<int> cpus(num_cores());
+    for(size_t i=0;i<cpus.size();++i)
+      cpus[i]=i;
+    return cpus;
+  }
+#endif
+
 #ifdef __linux__
+  vector<int> allowed_cpus() {
+    vector<int> cpus;
+    cpu_set_t set;
+    if(sched_getaffinity(0,sizeof(set),&set)==0) {
+      for(int i=0;i<CPU_SETSIZE;++i)
+        if(CPU_ISSET(i,&set))
+          cpus.push_back(i);
+    }
+    if(cpus.empty())
+      for(long i=0;i<sysconf(_SC_NPROCESSORS_ONLN);++i)
+        cpus.push_back(i);
+    return cpus;
+  }
+
+  // item is one of the comma separated list
+  bool in_list(const string& list, const string& item) {
+    return (","+list+",").find(","+item+",")!=string::npos;
+  }
+
+  // directories of the cgroups the process is in for controller, from its own up to the mount
+  // of the hierarchy, as the limits of all of them apply; /proc/self/cgroup has "0::<path>" for
+  // the v2 hierarchy and "<id>:<controllers>:<path>" for each v1 one, /proc/self/mountinfo where
+  // each is mounted and which of its cgroups is the root of the mount (not "/" in a container
+  // without a cgroup namespace, whose own cgroup is then the mount itself)
+  vector<string> cgroup_dirs(const string& controller) {
+    vector<std::pair<string,string>> cgroups;
+    std::ifstream self("/proc/self/cgroup");
+    string line;
+    while(std::getline(self,line)) {
+      size_t a=line.find(':');
+      size_t b=a==string::npos ? a : line.find(':',a+1);
+      if(b!=string::npos)
+        cgroups.emplace_back(line.substr(a+1,b-a-1),line.substr(b+1));
+    }
+
+    vector<string> dirs;
+    std::ifstream mounts("/proc/self/mountinfo");
+    while(std::getline(mounts,line)) {
+      // "<id> <parent> <dev> <root> <mount point> <options> [<tags>] - <type> <source> <super options>"
+      std::istringstream fields(line);
+      string id, parent, dev, root, mount_point, field, type, source, options;
+      fields>>id>>parent>>dev>>root>>mount_point;
+      while(fields>>field && field!="-")
+        ;
+      fields>>type>>source>>options;
+      bool v1=type=="cgroup";
+      if(!v1 && type!="cgroup2")
+        continue;
+      if(v1 && !in_list(options,controller))
+        continue;
+      for(const auto& cgroup:cgroups) {
+        if(v1!=!cgroup.first.empty() || (v1 && !in_list(cgroup.first,controller)))
+          continue;
+        string path=cgroup.second;
+        // only the part of the hierarchy below the root of the mount is visible
+        if(root!="/") {
+          bool below=path.compare(0,root.size(),root)==0 && (path.size()==root.size() || path[root.size()]=='/');
+          path=below ? path.substr(root.size()) : string();
+        }
+        while(!path.empty() && path!="/") {
+          dirs.push_back(mount_point+path+"/");
+          path=path.substr(0,path.rfind('/'));
+        }
+        dirs.push_back(mount_point+"/");
+      }
+    }
+    return dirs;
+  }
+
+  // CPUs granted by the CFS quota rounded up, the smallest along the cgroup path, 0 without a
+  // quota
+  int cgroup_cpus() {
+    int cpus=0;
+    for(const string& dir:cgroup_dirs("cpu")) {
+      unsigned long long quota=0, period=0;
+      // cgroup v2: "<quota> <period>" or "max <period>"
+      if(std::FILE* f=std::fopen((dir+"cpu.max").c_str(),"r")) {
+        if(std::fscanf(f,"%llu %llu",&quota,&period)!=2)
+          quota=0;
+        std::fclose(f);
+      }
+      else {
+        // cgroup v1, a quota of -1 means none
+        std::FILE* q=std::fopen((dir+"cpu.cfs_quota_us").c_str(),"r");
+        std::FILE* p=std::fopen((dir+"cpu.cfs_period_us").c_str(),"r");
+        long long v=-1;
+        if(q && p && std::fscanf(q,"%lld",&v)==1 && v>0 && std::fscanf(p,"%llu",&period)==1)
+          quota=v;
+        if(q)
+          std::fclose(q);
+        if(p)
+          std::fclose(p);
+      }
+      if(quota==0 || period==0)
+        continue;
+      int n=(int)((quota+period-1)/period);
+      if(cpus==0 || n<cpus)
+        cpus=n;
+    }
+    return cpus;
+  }
+
   int num_cores() {
-    return sysconf(_SC_NPROCESSORS_ONLN);
+    int n=allowed_cpus().size();
+    int quota=cgroup_cpus();
+    if(quota>0 && quota<n)
+      n=quota;
+    return n;
+  }
+#endif
+
+  bool pin_workers=false;
+
+  void set_pin_workers(bool pin) {
+    pin_workers=pin;
+  }
+
+  pthread_raii::thread_options worker_thread(const string& prefix, unsigned index) {
+    pthread_raii::thread_options options;
+    options.name=prefix+"-"+std::to_string(index);
+    if(pin_workers) {
+      vector<int> cpus=allowed_cpus();
+      options.cpu=cpus[index%cpus.size()];
+    }
+    return options;
+  }
+
+#ifdef _WIN32
+  uint64_t memory_limit() {
+    MEMORYSTATUSEX status;
+    status.dwLength=sizeof(status);
+    GlobalMemoryStatusEx(&status);
+    return status.ullTotalPhys;
+  }
+#endif
+
+#ifdef __linux__
+  uint64_t memory_limit() {
+    uint64_t limit=(uint64_t)sysconf(_SC_PHYS_PAGES)*sysconf(_SC_PAGESIZE);
+    // the smallest limit of the process's cgroup and its ancestors, cgroup v2 or v1; "max" or a
+    // huge v1 value means no limit
+    for(const string& dir:cgroup_dirs("memory"))
+      for(const char* name:{"memory.max","memory.limit_in_bytes"}) {
+        std::FILE* f=std::fopen((dir+name).c_str(),"r");
+        if(!f)
+          continue;
+        unsigned long long value;
+        bool found=std::fscanf(f,"%llu",&value)==1;
+        std::fclose(f);
+        if(found && value<limit)
+          limit=value;
+      }
+    return limit;
   }
 #endif
 
@@ -74,5 +242,75 @@ namespace util {
       c=tolower(c);
     return s;
   }
+
+#ifdef __linux__
+  bool read_small_file(const string& filename, vector<uint8_t>& data, size_t limit) {
+    int fd=open(filename.c_str(),O_RDONLY|O_CLOEXEC);
+    if(fd<0)
+      return false;
+    struct stat st;
+    if(fstat(fd,&st)!=0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size>limit) {
+      close(fd);
+      return false;
+    }
+    data.resize(st.st_size);
+    size_t done=0;
+    // a single read unless it is interrupted or the file shrinks under us
+    while(done<data.size()) {
+      ssize_t n=read(fd,data.data()+done,data.size()-done);
+      if(n<=0)
+        break;
+      done+=n;
+    }
+    close(fd);
+    data.resize(done);
+    return true;
+  }
+
+  uint64_t file_size(const string& filename) {
+    struct stat st;
+    if(stat(filename.c_str(),&st)!=0 || !S_ISREG(st.st_mode))
+      return 0;
+    return st.st_size;
+  }
+
+  void read_ahead(const string& filename) {
+    int fd=open(filename.c_str(),O_RDONLY|O_CLOEXEC);
+    if(fd<0)
+      return;
+    // starts asynchronous readahead of the whole file into the page cache
+    posix_fadvise(fd,0,0,POSIX_FADV_WILLNEED);
+    close(fd);
+  }
+#else
+  bool read_small_file(const string& filename, vector<uint8_t>& data, size_t limit) {
+    std::FILE* f=std::fopen(filename.c_str(),"rb");
+    if(!f)
+      return false;
+    std::fseek(f,0,SEEK_END);
+    long size=std::ftell(f);
+    if(size<0 || (unsigned long)size>limit) {
+      std::fclose(f);
+      return false;
+    }
+    std::fseek(f,0,SEEK_SET);
+    data.resize(size);
+    data.resize(std::fread(data.data(),1,data.size(),f));
+    std::fclose(f);
+    return true;
+  }
+
+  uint64_t file_size(const string& filename) {
+    std::FILE* f=std::fopen(filename.c_str(),"rb");
+    if(!f)
+      return 0;
+    std::fseek(f,0,SEEK_END);
+    long size=std::ftell(f);
+    std::fclose(f);
+    return size<0 ? 0 : size;
+  }
+
+  void read_ahead(const string&) {}
+#endif
   
 }
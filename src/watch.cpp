@@ -0,0 +1,129 @@
+#ifdef __linux__
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include "util.h"
+#include "watch.h"
+
+using std::runtime_error;
+using std::string;
+
+#ifdef __linux__
+namespace {
+  using clock = std::chrono::steady_clock;
+
+  const string wav_ext=".wav";
+  const string mp3_ext=".mp3";
+
+  volatile sig_atomic_t stop_requested=0;
+
+  void request_stop(int) {
+    stop_requested=1;
+  }
+
+  bool is_wav(const string& name) {
+    return wav_ext.size()<=name.size() &&
+      util::string_to_lower(name.substr(name.size()-wav_ext.size()))==wav_ext;
+  }
+
+  void submit(worker_pool::pool& workers, const string& dirname, const string& name) {
+    static pthread_raii::pmutex m_io;
+    workers.submit(worker_pool::job{dirname+name,dirname+name.substr(0,name.size()-wav_ext.size())+mp3_ext,
+      [name](const worker_pool::result& r) {
+        if(!r.ok) {
+          pthread_raii::plock_guard g(m_io);
+          std::cerr<<"File "<<name<<": "<<r.error<<std::endl;
+        }
+      }});
+  }
+}
+#endif
+
+namespace watch {
+
+#ifdef __linux__
+  void run(const string& dirname, worker_pool::pool& workers, unsigned debounce_ms) {
+    int fd=inotify_init1(IN_CLOEXEC|IN_NONBLOCK);
+    if(fd<0)
+      throw runtime_error(string("Can't initialize inotify: ")+strerror(errno));
+    // watching starts before the initial listing, so no file falls in between
+    if(inotify_add_watch(fd,dirname.c_str(),IN_CLOSE_WRITE|IN_MOVED_TO)<0) {
+      close(fd);
+      throw runtime_error("Can't watch "+dirname+": "+strerror(errno));
+    }
+
+    struct sigaction sa;
+    memset(&sa,0,sizeof(sa));
+    sa.sa_handler=request_stop;
+    sigaction(SIGINT,&sa,nullptr);
+    sigaction(SIGTERM,&sa,nullptr);
+
+    std::vector<string> existing;
+    util::list_files(dirname,existing,is_wav);
+    for(const string& name:existing)
+      submit(workers,dirname,name);
+
+    // file name -> time of its last event
+    std::map<string,clock::time_point> pending;
+    const clock::duration debounce=std::chrono::milliseconds(debounce_ms);
+    alignas(inotify_event) char buf[64*1024];
+    while(!stop_requested) {
+      int timeout=1000;
+      for(auto& p:pending) {
+        auto left=std::chrono::duration_cast<std::chrono::milliseconds>(p.second+debounce-clock::now()).count();
+        timeout=std::min<int>(timeout,std::max<int>(0,left+1));
+      }
+      pollfd pfd={fd,POLLIN,0};
+      if(poll(&pfd,1,timeout)>0) {
+        ssize_t n;
+        bool overflow=false;
+        // drain everything queued, a burst of events collapses into one entry per file
+        while((n=read(fd,buf,sizeof(buf)))>0) {
+          for(char* p=buf;p<buf+n;) {
+            inotify_event* e=(inotify_event*)p;
+            if(e->mask&IN_Q_OVERFLOW)
+              overflow=true;
+            else if(e->len && !(e->mask&IN_ISDIR) && is_wav(e->name))
+              pending[e->name]=clock::now();
+            p+=sizeof(inotify_event)+e->len;
+          }
+        }
+        // events were dropped, so any file may have been written: all of them go through the
+        // debounce again, which converts files converted before once more
+        if(overflow) {
+          std::cerr<<"inotify queue overflowed, rescanning "<<dirname<<std::endl;
+          std::vector<string> names;
+          util::list_files(dirname,names,is_wav);
+          auto now=clock::now();
+          for(const string& name:names)
+            pending[name]=now;
+        }
+      }
+      auto now=clock::now();
+      for(auto it=pending.begin();it!=pending.end();) {
+        if(now-it->second>=debounce) {
+          submit(workers,dirname,it->first);
+          it=pending.erase(it);
+        }
+        else
+          ++it;
+      }
+    }
+    close(fd);
+  }
+#else
+  void run(const string&, worker_pool::pool&, unsigned) {
+    throw runtime_error("Watch mode is only supported on Linux");
+  }
+#endif
+}
@@ -1,5 +1,8 @@
 #include "wav.h"
 #include "memory_layout.h"
+#include "pcm.h"
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <fstream>
 #include <stdexcept>
@@ -11,7 +14,6 @@
 using std::ifstream;
 using std::runtime_error;
 using std::string;
-using std::unique_ptr;
 
 using namespace wav;
 
@@ -36,33 +38,43 @@ struct fmt_chunk {
   uint16_t bits_per_sample;
   uint16_t extension_size;
   uint16_t valid_bits_per_sample;
-  uint16_t channel_mask;
+  uint32_t channel_mask;
   uint8_t guid[16];
 };
 
 struct data_chunk {
-  subchunk_header header;
-  std::unique_ptr<uint8_t[]> data;
+  uint64_t size;
+  std::streampos pos;
+};
+
+// 64 bit sizes of RF64 / BW64 files, whose 32 bit sizes are 0xFFFFFFFF
+struct ds64_chunk {
+  uint64_t riff_size;
+  uint64_t data_size;
 };
 
-void read_wave_riff_header(ifstream &file, riff_header &header) {
+// frames per read while looking for silence
+const size_t scan_frames = 16 * pcm::block_frames;
+
+void read_wave_riff_header(std::istream &file, riff_header &header) {
   file.read((char *)&header.id, 4);
   file.read((char *)&header.chunk_size, 4);
   file.read((char *)&header.format_id, 4);
   memory_layout::le_to_host(header.chunk_size);
-  if (header.id != RIFF_ID || header.format_id != WAV_FORMAT_ID) {
+  if ((header.id != RIFF_ID && header.id != RF64_ID && header.id != BW64_ID) ||
+      header.format_id != WAV_FORMAT_ID) {
     throw runtime_error("Not a wave file");
   }
 }
 
-int read_subchunk_header(ifstream &file, subchunk_header &header) {
+int read_subchunk_header(std::istream &file, subchunk_header &header) {
   file.read((char *)&header.id, 4);
   file.read((char *)&header.chunk_size, 4);
   memory_layout::le_to_host(header.chunk_size);
   return 8;
 }
 
-int read_fmt_chunk(ifstream &file, const subchunk_header &header,
+int read_fmt_chunk(std::istream &file, const subchunk_header &header,
                    fmt_chunk &chunk) {
   chunk.header = header;
 
@@ -84,46 +96,187 @@ int read_fmt_chunk(ifstream &file, const subchunk_header &header,
   memory_layout::le_to_host(chunk.extension_size);
   result += 2;
 
-  if (chunk.extension_size != 22)
-    return result;
-
-  file.read((char *)&chunk.valid_bits_per_sample, 2);
-  file.read((char *)&chunk.channel_mask, 4);
-  file.read((char *)&chunk.guid, 16);
-  memory_layout::les_to_host(chunk.valid_bits_per_sample, chunk.channel_mask);
-  result += 22;
+  // the extension of WAVE_FORMAT_EXTENSIBLE, possibly followed by more
+  if (chunk.extension_size >= 22 && header.chunk_size >= 40) {
+    file.read((char *)&chunk.valid_bits_per_sample, 2);
+    file.read((char *)&chunk.channel_mask, 4);
+    file.read((char *)&chunk.guid, 16);
+    memory_layout::les_to_host(chunk.valid_bits_per_sample,
+                               chunk.channel_mask);
+    result += 22;
+  }
 
+  // anything beyond the known fields
+  if (header.chunk_size > (uint32_t)result) {
+    file.ignore(header.chunk_size - result);
+    result = header.chunk_size;
+  }
   return result;
 }
 
-int read_data_chunk(ifstream &file, const subchunk_header &header,
-                    data_chunk &chunk) {
-  chunk.header = header;
-  chunk.data.reset(new uint8_t[header.chunk_size]);
-  file.read((char *)chunk.data.get(), header.chunk_size);
-  return header.chunk_size;
+// reads num_frames frames of the data chunk, starting at first_frame
+void read_frames(std::istream &file, const data_chunk &chunk, uint64_t first_frame,
+                 uint64_t num_frames, wav_t &wav) {
+  size_t frame_sz = wav.block_sz * wav.num_channels;
+  wav.data = buffer_pool::buffer(num_frames * frame_sz);
+  file.seekg(chunk.pos + std::streamoff(first_frame * frame_sz));
+  file.read((char *)wav.data.get(), num_frames * frame_sz);
+  // a truncated file holds fewer frames than its header claims, the rest of
+  // the pooled buffer is left over from an earlier file
+  wav.num_samples = file.gcount() / frame_sz;
 }
 
-int ignore_chunk(ifstream &file, const subchunk_header &header) {
-  file.ignore(header.chunk_size);
-  return header.chunk_size;
+// index of the first (or last, if from_back) frame with a sample above
+// threshold, num_frames if there is none
+size_t find_loud_frame(const uint8_t *src, const wav_t &wav, size_t num_frames,
+                       float threshold, bool from_back,
+                       std::vector<float> &scratch) {
+  size_t frame_sz = wav.block_sz * wav.num_channels;
+  scratch.resize(pcm::block_frames * wav.num_channels);
+  std::vector<float *> ch(wav.num_channels);
+  for (unsigned c = 0; c < wav.num_channels; ++c)
+    ch[c] = scratch.data() + c * pcm::block_frames;
+  size_t num_blocks = (num_frames + pcm::block_frames - 1) / pcm::block_frames;
+  for (size_t b = 0; b < num_blocks; ++b) {
+    size_t start = (from_back ? num_blocks - 1 - b : b) * pcm::block_frames;
+    size_t n = std::min(pcm::block_frames, num_frames - start);
+    pcm::to_float(src + start * frame_sz, wav.format_code, wav.block_sz,
+                  wav.num_channels, ch.data(), n);
+    // vectorized test of the whole block first, exact position only on a hit
+    float peak = 0;
+    for (unsigned c = 0; c < wav.num_channels; ++c)
+      peak = std::max(peak, pcm::peak(ch[c], n));
+    if (peak <= threshold)
+      continue;
+    for (size_t j = 0; j < n; ++j) {
+      size_t i = from_back ? n - 1 - j : j;
+      for (unsigned c = 0; c < wav.num_channels; ++c)
+        if (std::fabs(ch[c][i]) > threshold)
+          return start + i;
+    }
+  }
+  return num_frames;
+}
+
+// scans the data chunk from both ends and reads only the frames in between
+void read_trimmed(std::istream &file, const data_chunk &chunk, uint64_t num_frames,
+                  float threshold, wav_t &wav) {
+  size_t frame_sz = wav.block_sz * wav.num_channels;
+  buffer_pool::buffer block(scan_frames * frame_sz);
+  std::vector<float> scratch;
+
+  uint64_t first = num_frames;
+  for (uint64_t start = 0; start < num_frames && first == num_frames;
+       start += scan_frames) {
+    size_t n = std::min<uint64_t>(scan_frames, num_frames - start);
+    file.seekg(chunk.pos + std::streamoff(start * frame_sz));
+    file.read((char *)block.get(), n * frame_sz);
+    n = file.gcount() / frame_sz;
+    file.clear();
+    size_t i = find_loud_frame(block.get(), wav, n, threshold, false, scratch);
+    if (i < n)
+      first = start + i;
+  }
+
+  uint64_t end = first;
+  for (uint64_t stop = num_frames; stop > first && end == first;) {
+    uint64_t start = stop - std::min<uint64_t>(scan_frames, stop - first);
+    size_t n = stop - start;
+    file.seekg(chunk.pos + std::streamoff(start * frame_sz));
+    file.read((char *)block.get(), n * frame_sz);
+    n = file.gcount() / frame_sz;
+    file.clear();
+    size_t i = find_loud_frame(block.get(), wav, n, threshold, true, scratch);
+    if (i < n)
+      end = start + i + 1;
+    stop = start;
+  }
+
+  read_frames(file, chunk, first, end - first, wav);
+}
+
+// chunks of odd size are followed by a pad byte
+int64_t padded_size(uint64_t chunk_size) {
+  return chunk_size + (chunk_size & 1);
+}
+
+int64_t ignore_chunk(std::istream &file, const subchunk_header &header) {
+  int64_t size = padded_size(header.chunk_size);
+  file.ignore(size);
+  return size;
+}
+
+// RF64 and BW64 require ds64 as the first chunk, the optional table of
+// further 64 bit chunk sizes is skipped
+int64_t read_ds64_chunk(std::istream &file, ds64_chunk &chunk) {
+  subchunk_header header;
+  read_subchunk_header(file, header);
+  if (header.id != DS64_ID || header.chunk_size < 16)
+    throw runtime_error("Malformed file");
+  file.read((char *)&chunk.riff_size, 8);
+  file.read((char *)&chunk.data_size, 8);
+  memory_layout::les_to_host(chunk.riff_size, chunk.data_size);
+  file.ignore(header.chunk_size - 16);
+  return 8 + (int64_t)header.chunk_size;
+}
+
+// 0 and 0xFFFFFFFF are written by recorders and streams that don't know the
+// size up front
+bool placeholder_size(uint32_t size) { return size == 0 || size == 0xFFFFFFFF; }
+
+void set_format(const fmt_chunk &fmt, wav_t &wav) {
+  wav.block_sz = fmt.bits_per_sample / 8;
+  wav.sample_rate = fmt.sample_rate;
+  wav.num_channels = fmt.num_channels;
+  if (fmt.format_code != WAVE_FORMAT_EXTENSIBLE) {
+    wav.format_code = fmt.format_code;
+    wav.channel_mask = 0;
+  } else {
+    // without the extension there is neither a mask nor a format GUID
+    if (fmt.extension_size < 22)
+      throw runtime_error("Malformed file");
+    wav.format_code = fmt.guid[0];
+    wav.channel_mask = fmt.channel_mask;
+  }
+  wav.planar = false;
+  wav.num_samples = 0;
+  if (wav.block_sz == 0 || wav.num_channels == 0)
+    throw runtime_error("Malformed file");
 }
 
 namespace wav {
-void read_wav(string filename, wav_t &wav) {
+void read_wav(string filename, wav_t &wav, float trim_threshold) {
   ifstream file(filename, std::ios::binary);
+  read_wav(file, wav, trim_threshold);
+}
+
+void read_wav(std::istream &file, wav_t &wav, float trim_threshold) {
+  file.seekg(0, std::ios::end);
+  int64_t file_size = file.tellg();
+  file.seekg(0);
   riff_header riff_hdr;
   read_wave_riff_header(file, riff_hdr);
+  bool rf64 = riff_hdr.id != RIFF_ID;
+  ds64_chunk ds64;
 
   // remaining bytes
-  int remaining = riff_hdr.chunk_size - 4;
+  int64_t remaining;
+  bool riff_placeholder = !rf64 && placeholder_size(riff_hdr.chunk_size);
+  if (rf64) {
+    int64_t ds64_size = read_ds64_chunk(file, ds64);
+    remaining = (int64_t)ds64.riff_size - 4 - ds64_size;
+  } else {
+    remaining = riff_placeholder ? file_size - 12
+                                 : (int64_t)riff_hdr.chunk_size - 4;
+  }
 
   subchunk_header sub_hdr;
-  fmt_chunk fmt;
+  fmt_chunk fmt = {};
   data_chunk data;
   bool fmt_found = false;
   bool data_found = false;
 
+  // the data chunk is only located here and read once fmt is known
   while (remaining > 0 && (!fmt_found || !data_found)) {
     remaining -= read_subchunk_header(file, sub_hdr);
     if (sub_hdr.id == FMT_ID && !fmt_found) {
@@ -131,7 +284,26 @@ void read_wav(string filename, wav_t &wav) {
       remaining -= read_fmt_chunk(file, sub_hdr, fmt);
     } else if (sub_hdr.id == DATA_ID && !data_found) {
       data_found = true;
-      remaining -= read_data_chunk(file, sub_hdr, data);
+      data.pos = file.tellg();
+      // a size of 0 is only a placeholder if the RIFF size is one too or
+      // ends with the data chunk, otherwise the chunk is empty and further
+      // chunks follow
+      bool zero_placeholder = sub_hdr.chunk_size == 0 &&
+                              (riff_placeholder || remaining == 0);
+      if (rf64 && sub_hdr.chunk_size == 0xFFFFFFFF)
+        data.size = ds64.data_size;
+      else if (sub_hdr.chunk_size == 0xFFFFFFFF || zero_placeholder) {
+        // the samples run to the end of the file, whatever the RIFF size says
+        data.size = file_size - (int64_t)data.pos;
+        remaining = data.size;
+      } else
+        data.size = sub_hdr.chunk_size;
+      remaining -= data.size;
+      // fmt comes later, the samples are skipped for now with their pad byte
+      if (!fmt_found) {
+        file.seekg(data.pos + std::streamoff(padded_size(data.size)));
+        remaining -= data.size & 1;
+      }
     } else {
       remaining -= ignore_chunk(file, sub_hdr);
     }
@@ -140,15 +312,56 @@ void read_wav(string filename, wav_t &wav) {
   if (remaining < 0 || !fmt_found || !data_found)
     throw runtime_error("Malformed file");
 
-  wav.block_sz = fmt.bits_per_sample / 8;
-  wav.sample_rate = fmt.sample_rate;
-  wav.num_channels = fmt.num_channels;
-  if (fmt.format_code != WAVE_FORMAT_EXTENSIBLE)
-    wav.format_code = fmt.format_code;
+  set_format(fmt, wav);
+
+  uint64_t num_frames = data.size / (wav.block_sz * wav.num_channels);
+  if (trim_threshold >= 0)
+    read_trimmed(file, data, num_frames, trim_threshold, wav);
   else
-    wav.format_code = fmt.guid[0];
+    read_frames(file, data, 0, num_frames, wav);
+}
+
+uint64_t read_wav_header(std::istream &in, wav_t &wav) {
+  riff_header riff_hdr;
+  read_wave_riff_header(in, riff_hdr);
+  bool rf64 = riff_hdr.id != RIFF_ID;
+  ds64_chunk ds64;
+  if (rf64)
+    read_ds64_chunk(in, ds64);
+
+  subchunk_header sub_hdr;
+  fmt_chunk fmt = {};
+  bool fmt_found = false;
+  // a stream can't seek back, so everything up to data is read in order
+  while (true) {
+    read_subchunk_header(in, sub_hdr);
+    if (!in)
+      throw runtime_error("Malformed file");
+    if (sub_hdr.id == FMT_ID && !fmt_found) {
+      fmt_found = true;
+      read_fmt_chunk(in, sub_hdr, fmt);
+    } else if (sub_hdr.id == DATA_ID) {
+      if (!fmt_found)
+        throw runtime_error("Data chunk before fmt chunk in stream");
+      set_format(fmt, wav);
+      if (rf64 && sub_hdr.chunk_size == 0xFFFFFFFF)
+        return ds64.data_size;
+      return placeholder_size(sub_hdr.chunk_size) ? unknown_size
+                                                  : sub_hdr.chunk_size;
+    } else {
+      ignore_chunk(in, sub_hdr);
+    }
+  }
+}
 
-  wav.num_samples = data.header.chunk_size / (wav.block_sz * wav.num_channels);
-  wav.data = std::move(data.data);
+size_t read_wav_frames(std::istream &in, wav_t &wav, size_t num_frames) {
+  size_t frame_sz = wav.block_sz * wav.num_channels;
+  if (wav.data.capacity() < num_frames * frame_sz)
+    wav.data = buffer_pool::buffer(num_frames * frame_sz);
+  in.read((char *)wav.data.get(), num_frames * frame_sz);
+  // a partial frame at the end of the stream is dropped
+  wav.num_samples = in.gcount() / frame_sz;
+  wav.planar = false;
+  return wav.num_samples;
 }
 } // namespace wav
@@ -0,0 +1,72 @@
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include "memory_buf.h"
+#include "wav2mp3.h"
+
+namespace {
+  class read_buf : public std::streambuf {
+  public:
+    explicit read_buf(const wav2mp3::read_callback& read) : read_(read) {}
+  protected:
+    int_type underflow() override {
+      size_t n=read_((uint8_t*)buf_,sizeof(buf_));
+      if(n==0)
+        return traits_type::eof();
+      setg(buf_,buf_,buf_+n);
+      return traits_type::to_int_type(*gptr());
+    }
+  private:
+    const wav2mp3::read_callback& read_;
+    char buf_[65536];
+  };
+
+  // unbuffered, every write goes straight to the callback
+  class write_buf : public std::streambuf {
+  public:
+    explicit write_buf(const wav2mp3::write_callback& write) : write_(write) {}
+  protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+      write_((const uint8_t*)s,n);
+      return n;
+    }
+    int_type overflow(int_type c) override {
+      if(!traits_type::eq_int_type(c,traits_type::eof())) {
+        uint8_t b=(uint8_t)c;
+        write_(&b,1);
+      }
+      return traits_type::not_eof(c);
+    }
+  private:
+    const wav2mp3::write_callback& write_;
+  };
+}
+
+namespace wav2mp3 {
+
+  converter::converter(const convert::settings& s) : settings_(s) {}
+
+  const convert::settings& converter::settings() const {
+    return settings_;
+  }
+
+  const std::vector<uint8_t>& converter::convert(const uint8_t* wav, size_t size) {
+    memory_buf buf(wav,size);
+    std::istream in(&buf);
+    convert::convert(in,output_,settings_);
+    return output_;
+  }
+
+  void converter::convert(const uint8_t* wav, size_t size, const write_callback& out) {
+    convert(wav,size);
+    out(output_.data(),output_.size());
+  }
+
+  void converter::convert(const read_callback& in, const write_callback& out) {
+    read_buf in_buf(in);
+    write_buf out_buf(out);
+    std::istream in_stream(&in_buf);
+    std::ostream out_stream(&out_buf);
+    convert::convert_stream(in_stream,out_stream,settings_);
+  }
+}
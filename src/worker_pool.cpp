@@ -0,0 +1,129 @@
+#include <chrono>
+#include <exception>
+#include "backlog.h"
+#include "concurrency.h"
+#include "memory_budget.h"
+#include "util.h"
+#include "worker_pool.h"
+
+namespace worker_pool {
+  using namespace pthread_raii;
+  using clock = std::chrono::steady_clock;
+
+  struct pool::entry {
+    job j;
+    clock::time_point queued;
+    //! estimated peak memory, 0 without a memory budget
+    uint64_t bytes;
+  };
+
+  namespace {
+    double ms(clock::duration d) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(d).count()/1000.0;
+    }
+  }
+
+  pool::pool(const convert::settings& s, unsigned num_workers, size_t capacity)
+    : settings_(s), capacity_(capacity), stopping_(false) {
+    threads_.reserve(num_workers);
+    for(unsigned i=0;i<num_workers;++i)
+      threads_.emplace_back(util::worker_thread("worker",i),[this, i]() { work(i); });
+  }
+
+  pool::~pool() {
+    {
+      plock_guard g(m_);
+      stopping_=true;
+      not_empty_.broadcast();
+      not_full_.broadcast();
+    }
+    // workers parked by the concurrency controller finish the queue as well
+    concurrency::drain();
+    threads_.clear();
+  }
+
+  uint64_t pool::job_memory(const job& j) const {
+    return memory_budget::limit() ? convert::estimate_memory(j.filename_in,settings_) : 0;
+  }
+
+  bool pool::try_submit(job j) {
+    uint64_t bytes=job_memory(j);
+    plock_guard g(m_);
+    if(queue_.size()>=capacity_)
+      return false;
+    queue_.push_back(entry{std::move(j),clock::now(),bytes});
+    not_empty_.signal();
+    return true;
+  }
+
+  void pool::submit(job j) {
+    uint64_t bytes=job_memory(j);
+    plock_guard g(m_);
+    while(queue_.size()>=capacity_ && !stopping_)
+      not_full_.wait(m_);
+    queue_.push_back(entry{std::move(j),clock::now(),bytes});
+    not_empty_.signal();
+  }
+
+  size_t pool::queued() {
+    plock_guard g(m_);
+    return queue_.size();
+  }
+
+  void pool::work(unsigned index) {
+    while(true) {
+      concurrency::admit(index);
+      entry e;
+      bool reserved=false;
+      size_t queued;
+      {
+        plock_guard g(m_);
+        // queued jobs are still done after stopping_ is set
+        while(queue_.empty() && !stopping_)
+          not_empty_.wait(m_);
+        if(queue_.empty())
+          return;
+        // the oldest job that fits into the memory budget, if none does the oldest one is
+        // waited for
+        auto it=queue_.begin();
+        for(;it!=queue_.end();++it)
+          if(memory_budget::try_acquire(it->bytes)) {
+            reserved=true;
+            break;
+          }
+        if(!reserved)
+          it=queue_.begin();
+        e=std::move(*it);
+        queue_.erase(it);
+        queued=queue_.size();
+        not_full_.signal();
+      }
+      if(!reserved)
+        memory_budget::acquire(e.bytes);
+      memory_budget::reservation reservation(e.bytes);
+
+      result r{true,std::string(),0,0};
+      auto start=clock::now();
+      r.queued_ms=ms(start-e.queued);
+      // with a drain target the quality drops while the queue is too long for it
+      convert::settings degraded;
+      int quality=backlog::quality(queued,settings_.quality);
+      if(quality!=settings_.quality) {
+        degraded=settings_;
+        degraded.quality=quality;
+      }
+      try {
+        concurrency::job_timer timer;
+        timer.finish(convert::convert(e.j.filename_in,e.j.filename_out,quality==settings_.quality ? settings_ : degraded));
+        backlog::record(ms(clock::now()-start)/1000,quality);
+      }
+      catch(std::exception& ex) {
+        r.ok=false;
+        r.error=ex.what();
+      }
+      r.convert_ms=ms(clock::now()-start);
+      if(e.j.done)
+        e.j.done(r);
+    }
+  }
+}
@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include "output_file.h"
+#include "pthread_raii.h"
+#include "write_behind.h"
+
+using write_behind::chunks;
+using write_behind::durability;
+
+namespace {
+  using namespace pthread_raii;
+  using std::runtime_error;
+  using std::string;
+  using clock = std::chrono::steady_clock;
+
+  // files held open by one batch, keeps batch mode well below the descriptor limit
+  const size_t max_batch_files=256;
+  // in batch mode the writer waits this long for more outputs before it writes a batch,
+  // unless half of the budget is queued already
+  const unsigned batch_window_ms=20;
+  // written outputs kept for the workers to fill again, about one per worker
+  const size_t max_spares=64;
+
+  struct item {
+    string filename;
+    chunks data;
+    size_t size;
+  };
+
+  pmutex m;
+  pcond not_empty;
+  pcond not_full;
+  std::deque<item> queue;
+  size_t in_flight=0;
+  size_t max_bytes=0;
+  durability mode=durability::none;
+  bool started=false;
+  std::unique_ptr<pthread> writer_thread;
+  std::vector<std::vector<uint8_t>> spares;
+
+  std::atomic<uint64_t> files(0);
+  std::atomic<uint64_t> bytes(0);
+  std::atomic<uint64_t> failed(0);
+  std::atomic<uint64_t> batches(0);
+  std::atomic<uint64_t> fsyncs(0);
+  std::atomic<uint64_t> wait_ns(0);
+
+  // with the trailing slash, empty for the working directory
+  string dirname_of(const string& filename) {
+    return filename.substr(0,filename.find_last_of('/')+1);
+  }
+
+  // failed counts outputs only, an error syncing a directory leaves its files in place
+  void report(const string& filename, const std::exception& e, bool output=true) {
+    if(output)
+      ++failed;
+    std::cerr<<"File "<<filename<<": "<<e.what()<<std::endl;
+  }
+
+  // writes and publishes a batch, in batch mode the fsyncs of all files come after all writes
+  void write_batch(std::vector<item>& batch) {
+    std::vector<std::unique_ptr<output_file>> held;
+    std::vector<const item*> held_items;
+    for(const item& it:batch) {
+      try {
+        std::unique_ptr<output_file> out(new output_file(it.filename,it.size));
+        out->write(it.data);
+        if(mode==durability::batch) {
+          held.push_back(std::move(out));
+          held_items.push_back(&it);
+          continue;
+        }
+        if(mode==durability::file) {
+          out->sync();
+          ++fsyncs;
+        }
+        out->commit();
+        if(mode==durability::file) {
+          output_file::sync_directory(dirname_of(it.filename));
+          ++fsyncs;
+        }
+        ++files;
+        bytes+=it.size;
+      }
+      catch(std::exception& e) {
+        report(it.filename,e);
+      }
+    }
+    if(mode!=durability::batch)
+      return;
+    std::set<string> dirs;
+    for(size_t i=0;i<held.size();++i) {
+      const string& filename=held_items[i]->filename;
+      try {
+        held[i]->sync();
+        ++fsyncs;
+        held[i]->commit();
+        dirs.insert(dirname_of(filename));
+        ++files;
+        bytes+=held_items[i]->size;
+      }
+      catch(std::exception& e) {
+        report(filename,e);
+      }
+    }
+    for(const string& dir:dirs) {
+      try {
+        output_file::sync_directory(dir);
+        ++fsyncs;
+      }
+      catch(std::exception& e) {
+        report(dir,e,false);
+      }
+    }
+  }
+
+  void write_loop() {
+    std::vector<item> batch;
+    while(true) {
+      {
+        plock_guard g(m);
+        while(started && queue.empty())
+          not_empty.wait(m);
+        if(queue.empty())
+          return;
+        if(mode==durability::batch) {
+          auto deadline=clock::now()+std::chrono::milliseconds(batch_window_ms);
+          while(started && queue.size()<max_batch_files && in_flight<max_bytes/2) {
+            auto left=std::chrono::duration_cast<std::chrono::milliseconds>(deadline-clock::now()).count();
+            if(left<=0)
+              break;
+            not_empty.wait_for(m,(unsigned)left);
+          }
+        }
+        // everything that piled up while the last batch was written goes out together
+        while(!queue.empty() && batch.size()<max_batch_files) {
+          batch.push_back(std::move(queue.front()));
+          queue.pop_front();
+        }
+      }
+      write_batch(batch);
+      ++batches;
+      size_t done=0;
+      for(const item& it:batch)
+        done+=it.size;
+      plock_guard g(m);
+      in_flight-=done;
+      not_full.broadcast();
+      // the written buffers go back to the workers with their capacity
+      for(item& it:batch)
+        for(std::vector<uint8_t>& c:it.data)
+          if(spares.size()<max_spares) {
+            c.clear();
+            spares.push_back(std::move(c));
+          }
+      batch.clear();
+    }
+  }
+}
+
+namespace write_behind {
+
+  durability parse_durability(const string& s) {
+    if(s=="none")
+      return durability::none;
+    if(s=="file")
+      return durability::file;
+    if(s=="batch")
+      return durability::batch;
+    throw runtime_error("Unknown fsync mode "+s);
+  }
+
+  void start(size_t bytes, durability d) {
+    {
+      plock_guard g(m);
+      max_bytes=std::max<size_t>(1,bytes);
+      mode=d;
+      started=true;
+    }
+    writer_thread.reset(new pthread(thread_options("write-behind"),write_loop));
+  }
+
+  void stop() {
+    {
+      plock_guard g(m);
+      started=false;
+      not_empty.broadcast();
+    }
+    writer_thread.reset();
+  }
+
+  bool running() {
+    plock_guard g(m);
+    return started;
+  }
+
+  void submit(const string& filename, chunks data) {
+    size_t size=0;
+    for(const std::vector<uint8_t>& c:data)
+      size+=c.size();
+    plock_guard g(m);
+    // an output larger than the whole budget still gets through on its own
+    if(in_flight>0 && in_flight+size>max_bytes) {
+      auto start=clock::now();
+      while(in_flight>0 && in_flight+size>max_bytes)
+        not_full.wait(m);
+      wait_ns+=std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now()-start).count();
+    }
+    in_flight+=size;
+    queue.push_back(item{filename,std::move(data),size});
+    not_empty.signal();
+  }
+
+  std::vector<uint8_t> spare() {
+    plock_guard g(m);
+    std::vector<uint8_t> buffer;
+    if(!spares.empty()) {
+      buffer.swap(spares.back());
+      spares.pop_back();
+    }
+    return buffer;
+  }
+
+  stats_t stats() {
+    return stats_t{files.load(),bytes.load(),failed.load(),batches.load(),fsyncs.load(),wait_ns/1e6};
+  }
+}
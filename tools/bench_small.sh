@@ -0,0 +1,34 @@
+#!/bin/sh
+# small file throughput: converts a corpus of tiny clips (default 100000 files of 0.1 s,
+# 16 bit mono at 44.1 kHz) in directory mode and reports files per second
+# usage: tools/bench_small.sh [NUM_FILES] [SECONDS] [WAV2MP3 OPTIONS...]
+# WAV2MP3 selects another executable, e.g. to compare builds
+set -e
+
+num_files=${1:-100000}
+seconds=${2:-0.1}
+[ $# -gt 0 ] && shift
+[ $# -gt 0 ] && shift
+exe=${WAV2MP3:-$(dirname "$0")/../wav2mp3}
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# one 440 Hz clip, copied to all file names by a few tee processes
+LC_ALL=C awk -v seconds="$seconds" 'BEGIN {
+  rate=44100; n=int(rate*seconds); size=2*n
+  printf "RIFF"; u32(36+size); printf "WAVEfmt "; u32(16)
+  u16(1); u16(1); u32(rate); u32(2*rate); u16(2); u16(16)
+  printf "data"; u32(size)
+  for(i=0;i<n;++i) {
+    v=int(16384*sin(2*3.14159265358979*440*i/rate))
+    u16(v<0 ? v+65536 : v)
+  }
+}
+function u16(v) { printf "%c%c", v%256, int(v/256)%256 }
+function u32(v) { u16(v%65536); u16(int(v/65536)) }' > "$dir/clip.wav"
+mkdir "$dir/corpus"
+seq -f "$dir/corpus/clip%07g.wav" 1 "$num_files" |
+  xargs sh -c 'tee "$@" < "'"$dir"'/clip.wav" > /dev/null' sh
+
+sync
+"$exe" --stats "$@" "$dir/corpus" | grep '^files:'
@@ -0,0 +1,43 @@
+#!/bin/sh
+# files beyond 4 GiB: streams an RF64 file of 1900 s of 6 channel 64 bit float at 48 kHz (4.4 GB)
+# to disk with wav2mp3_corpus, checks its ds64 sizes and 64 bit frame count and converts it in pipe
+# mode, which reads and encodes block by block; neither step holds the file in memory
+# usage: tools/test_rf64.sh [SECONDS]
+# the file goes to TMPDIR, which needs room for it; fewer SECONDS test RF64 below 4 GiB
+set -e
+
+seconds=${1:-1900}
+root=$(dirname "$0")/..
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+fail() { echo "FAIL: $*" >&2; exit 1; }
+
+"$root/wav2mp3_corpus" "$dir" --files 1 --formats float64 --channels 6 --rates 48000 \
+  --duration "$seconds,$seconds" --signals sine --odd 0 --rf64 > /dev/null
+wav=$(ls "$dir"/*.wav)
+frames=$(awk -F'\t' 'NR==2 { print $5 }' "$dir/manifest.tsv")
+size=$(wc -c < "$wav")
+
+# unsigned little endian integer of $2 bytes at offset $1
+le() { od -An -tu1 -j "$1" -N "$2" "$wav" | awk '{ for(i=NF;i>0;--i) v=v*256+$i } END { printf "%.0f\n", v }'; }
+text() { dd if="$wav" bs=1 skip="$1" count=4 2> /dev/null; }
+
+# RF64 header, ds64 (RIFF size, data size, sample count), fmt of 40 bytes, data
+[ "$(text 0)" = RF64 ] || fail "no RF64 header"
+[ "$(le 4 4)" = 4294967295 ] || fail "RIFF size isn't 0xFFFFFFFF"
+[ "$(text 12)" = ds64 ] || fail "no ds64 chunk"
+[ "$(le 20 8)" = $((size-8)) ] || fail "ds64 RIFF size $(le 20 8), file has $((size-8))"
+[ "$(le 28 8)" = $((frames*6*8)) ] || fail "ds64 data size $(le 28 8), expected $((frames*6*8))"
+[ "$(le 36 8)" = "$frames" ] || fail "ds64 sample count $(le 36 8), expected $frames"
+[ "$(text 96)" = data ] && [ "$(le 100 4)" = 4294967295 ] || fail "data size isn't 0xFFFFFFFF"
+[ "$seconds" != 1900 ] || [ "$frames" -gt 4294967295 ] || [ "$(le 28 8)" -gt 4294967295 ] ||
+  fail "data chunk not beyond 4 GiB"
+
+# 128 kbps at 48 kHz are 384 bytes per frame of 1152 samples; the encoder delay and the empty
+# Xing/LAME frame add a few frames
+"$root/wav2mp3" --pipe < "$wav" > "$dir/out.mp3"
+mp3_frames=$(($(wc -c < "$dir/out.mp3")/384))
+expected=$((frames/1152))
+[ $((mp3_frames-expected)) -ge 0 ] && [ $((mp3_frames-expected)) -le 4 ] ||
+  fail "$mp3_frames MP3 frames for $frames samples, expected about $expected"
+echo "RF64 OK: $size bytes, $frames frames, $mp3_frames MP3 frames"
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "memory_buf.h"
+#include "memory_layout.h"
+#include "pcm.h"
+#include "wav.h"
+#include "wav2mp3.h"
+#include "wav_synth.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+  using clock = std::chrono::steady_clock;
+
+  struct options {
+    string filter;
+    string out;
+    string baseline;
+    double tolerance=0.1;
+    double min_time=0.5;
+    double seconds=10;
+  };
+
+  struct result {
+    string name;
+    string item;
+    uint64_t items;
+    double ns_per_item;
+  };
+
+  // best of several runs: the fastest run is the one least disturbed by the rest of the system
+  result measure(const options& o, const string& name, const string& item, uint64_t items, const std::function<void()>& run) {
+    double best=0;
+    double total=0;
+    for(int runs=0;runs<3 || total<o.min_time;++runs) {
+      auto start=clock::now();
+      run();
+      double t=std::chrono::duration<double>(clock::now()-start).count();
+      total+=t;
+      if(runs==0 || t<best)
+        best=t;
+    }
+    return result{name,item,items,best*1e9/items};
+  }
+
+  string to_json(const result& r) {
+    std::ostringstream s;
+    s<<"{\"name\":\""<<r.name<<"\",\"item\":\""<<r.item<<"\",\"items\":"<<r.items
+     <<",\"ns_per_item\":"<<r.ns_per_item<<",\"items_per_second\":"<<1e9/r.ns_per_item<<"}";
+    return s.str();
+  }
+
+  // the two fields --compare needs from a line written by to_json
+  bool from_json(const string& line, string& name, double& ns_per_item) {
+    size_t n=line.find("\"name\":\"");
+    size_t t=line.find("\"ns_per_item\":");
+    if(n==string::npos || t==string::npos)
+      return false;
+    n+=8;
+    name=line.substr(n,line.find('"',n)-n);
+    ns_per_item=std::atof(line.c_str()+t+14);
+    return true;
+  }
+
+  vector<uint8_t> synth_file(const wav_synth::format& f, uint64_t frames) {
+    std::ostringstream s;
+    wav_synth::write_wav(s,f,frames,wav_synth::signal::sweep,1);
+    string str=s.str();
+    return vector<uint8_t>(str.begin(),str.end());
+  }
+
+  void run_all(const options& o, const std::function<void(const result&)>& report) {
+    auto wanted=[&](const string& name) {
+      return o.filter.empty() || name.find(o.filter)!=string::npos;
+    };
+    const size_t samples=1<<20;
+    vector<uint8_t> src(samples*8);
+    vector<uint8_t> dst(samples*8);
+    wav_synth::random r(1);
+    for(auto& b : src)
+      b=(uint8_t)r.next();
+
+    // the sample kernels, on a megasample each
+    auto kernel=[&](const string& name, const std::function<void()>& run) {
+      if(wanted(name))
+        report(measure(o,name,"sample",samples,run));
+    };
+    kernel("decode_alaw",[&]() { pcm::decode_alaw(src.data(),(short*)dst.data(),samples); });
+    kernel("decode_ulaw",[&]() { pcm::decode_ulaw(src.data(),(short*)dst.data(),samples); });
+    kernel("pad_le_3_4",[&]() { memory_layout::pad_le(dst.data(),src.data(),3,4,samples); });
+    kernel("pad_le_1_2",[&]() { memory_layout::pad_le(dst.data(),src.data(),1,2,samples); });
+    kernel("le_to_host_16",[&]() { memory_layout::le_to_host_arr<uint16_t>(src.data(),samples); });
+    kernel("le_to_host_32",[&]() { memory_layout::le_to_host_arr<uint32_t>(src.data(),samples); });
+    kernel("le_to_host_64",[&]() { memory_layout::le_to_host_arr<uint64_t>(src.data(),samples); });
+
+    // parsing and conversion of whole files, per second of audio
+    const unsigned rate=44100;
+    const uint64_t frames=(uint64_t)(o.seconds*rate);
+    wav2mp3::converter converter;
+    for(const wav_synth::sample_format& c : wav_synth::sample_formats)
+      for(unsigned channels : {1u,2u,6u}) {
+        string suffix=string(c.name)+"_"+std::to_string(channels)+"ch";
+        bool read=wanted("read_wav_"+suffix);
+        bool convert=wanted("convert_"+suffix);
+        if(!read && !convert)
+          continue;
+        // more than two channels need a channel mask
+        vector<uint8_t> file=synth_file(wav_synth::format{c.format_code,c.bits,channels,rate,channels>2},frames);
+        if(read)
+          report(measure(o,"read_wav_"+suffix,"second",(uint64_t)o.seconds,[&]() {
+            memory_buf buf(file.data(),file.size());
+            std::istream in(&buf);
+            wav::wav_t wav;
+            wav::read_wav(in,wav);
+          }));
+        if(convert)
+          report(measure(o,"convert_"+suffix,"second",(uint64_t)o.seconds,[&]() { converter.convert(file.data(),file.size()); }));
+      }
+  }
+
+  void usage(const char* name) {
+    cerr<<"usage: "<<name<<" [--filter SUBSTRING] [--min-time S] [--seconds S | --quick] [--out FILE]"<<endl
+        <<"       [--compare BASELINE [--tolerance FRACTION]]"<<endl
+        <<"runs the micro and end-to-end benchmarks and writes one JSON object per benchmark and line;"<<endl
+        <<"with --compare, benchmarks more than tolerance (default 0.1) slower than in BASELINE fail"<<endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  options o;
+  for(int i=1;i<argc;++i) {
+    string arg=argv[i];
+    bool has_value=i+1<argc;
+    if(arg=="--filter" && has_value)
+      o.filter=argv[++i];
+    else if(arg=="--out" && has_value)
+      o.out=argv[++i];
+    else if(arg=="--compare" && has_value)
+      o.baseline=argv[++i];
+    else if(arg=="--tolerance" && has_value)
+      o.tolerance=std::atof(argv[++i]);
+    else if(arg=="--min-time" && has_value)
+      o.min_time=std::atof(argv[++i]);
+    else if(arg=="--seconds" && has_value)
+      o.seconds=std::atof(argv[++i]);
+    else if(arg=="--quick") {
+      o.min_time=0.05;
+      o.seconds=1;
+    }
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  // the end-to-end benchmarks count whole seconds of audio
+  o.seconds=std::max(1.0,std::floor(o.seconds));
+
+  std::map<string,double> baseline;
+  if(!o.baseline.empty()) {
+    std::ifstream in(o.baseline);
+    if(!in) {
+      cerr<<"Can't read "<<o.baseline<<endl;
+      return 2;
+    }
+    string line, name;
+    double ns;
+    while(std::getline(in,line))
+      if(from_json(line,name,ns))
+        baseline[name]=ns;
+  }
+  std::ofstream file;
+  if(!o.out.empty()) {
+    file.open(o.out);
+    if(!file) {
+      cerr<<"Can't write "<<o.out<<endl;
+      return 2;
+    }
+  }
+  std::ostream& out=o.out.empty() ? std::cout : file;
+
+  int regressions=0;
+  try {
+    run_all(o,[&](const result& r) {
+      out<<to_json(r)<<endl;
+      auto b=baseline.find(r.name);
+      if(b==baseline.end())
+        return;
+      double change=r.ns_per_item/b->second-1;
+      bool regression=change>o.tolerance;
+      regressions+=regression;
+      cerr<<r.name<<": "<<std::showpos<<(int)std::lrint(change*100)<<std::noshowpos<<"% time per "<<r.item
+          <<(regression ? ", REGRESSION" : "")<<endl;
+    });
+  }
+  catch(const std::exception& e) {
+    cerr<<e.what()<<endl;
+    return 2;
+  }
+  if(regressions) {
+    cerr<<regressions<<" regression(s)"<<endl;
+    return 1;
+  }
+  return 0;
+}
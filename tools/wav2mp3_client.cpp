@@ -0,0 +1,108 @@
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdexcept>
+#include <unistd.h>
+#include "server.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// paths are resolved by the daemon, so relative ones are made absolute here
+string absolute(const string& path) {
+  if(!path.empty() && path[0]=='/')
+    return path;
+  char cwd[4096];
+  if(!getcwd(cwd,sizeof(cwd)))
+    throw std::runtime_error("Can't determine working directory");
+  return string(cwd)+"/"+path;
+}
+
+int main(int argc, char** argv) {
+  if(argc<4 || argc%2!=0) {
+    cerr<<"usage: "<<argv[0]<<" SOCKET IN OUT [IN OUT ...]"<<endl;
+    return 2;
+  }
+  struct job {
+    string in;
+    string out;
+  };
+  vector<job> jobs;
+  for(int i=2;i+1<argc;i+=2)
+    jobs.push_back(job{absolute(argv[i]),absolute(argv[i+1])});
+
+  int failed=0;
+  try {
+    int fd=server::connect(argv[1]);
+    auto send=[&](size_t id) {
+      if(!server::write_frame(fd,std::to_string(id)+"\n"+jobs[id].in+"\n"+jobs[id].out))
+        throw std::runtime_error("Connection to the daemon lost");
+    };
+    // a window of jobs in flight: with all of them sent up front, the client would stop reading
+    // responses while it is blocked on writing requests that the daemon doesn't read
+    const size_t window=64;
+    size_t next=0;
+    size_t in_flight=0;
+    std::deque<size_t> rejected;
+    auto send_next=[&]() {
+      if(!rejected.empty()) {
+        send(rejected.front());
+        rejected.pop_front();
+      }
+      else if(next<jobs.size())
+        send(next++);
+      else
+        return;
+      ++in_flight;
+    };
+    while(in_flight<window && next<jobs.size())
+      send_next();
+
+    // jobs rejected with BUSY are sent again when another job is done, or after a short pause
+    // (longer each time) if none is left in flight
+    size_t pending=jobs.size();
+    unsigned backoff_us=1000;
+    string response;
+    while(pending) {
+      if(!server::read_frame(fd,response))
+        throw std::runtime_error("Connection to the daemon lost");
+      size_t space=response.find(' ');
+      size_t id=std::strtoul(response.substr(0,space).c_str(),nullptr,10);
+      string status=space==string::npos ? string() : response.substr(space+1);
+      if(id>=jobs.size())
+        continue;
+      --in_flight;
+      if(status=="BUSY") {
+        rejected.push_back(id);
+        if(in_flight==0) {
+          usleep(backoff_us);
+          backoff_us=std::min(backoff_us*2,100000u);
+          send_next();
+        }
+        continue;
+      }
+      backoff_us=1000;
+      --pending;
+      send_next();
+      if(status.compare(0,3,"OK ")==0) {
+        double queued=0, converted=0;
+        sscanf(status.c_str()+3,"%lf %lf",&queued,&converted);
+        cout<<jobs[id].in<<": queued "<<queued<<" ms, converted in "<<converted<<" ms"<<endl;
+      } else {
+        cerr<<jobs[id].in<<": "<<(status.compare(0,4,"ERR ")==0 ? status.substr(4) : status)<<endl;
+        ++failed;
+      }
+    }
+    close(fd);
+  }
+  catch(std::runtime_error& e) {
+    cerr<<e.what()<<endl;
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "wav_synth.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+namespace {
+  enum class distribution { uniform, log, pareto };
+
+  struct options {
+    string dir;
+    unsigned files=100;
+    uint64_t seed=1;
+    double min_seconds=0.1;
+    double max_seconds=60;
+    distribution durations=distribution::log;
+    vector<string> formats;
+    vector<unsigned> channels{1,2,6};
+    vector<unsigned> rates{44100};
+    vector<wav_synth::signal> signals{wav_synth::signal::sine,wav_synth::signal::sweep,wav_synth::signal::noise,
+                                      wav_synth::signal::silence};
+    //! share of files with extra chunks, fmt after data, cbSize or EXTENSIBLE for 1 and 2 channels
+    double odd=0.25;
+    bool rf64=false;
+  };
+
+  vector<string> split(const string& s) {
+    vector<string> parts;
+    std::istringstream in(s);
+    string part;
+    while(std::getline(in,part,','))
+      if(!part.empty())
+        parts.push_back(part);
+    if(parts.empty())
+      throw std::runtime_error("Empty list");
+    return parts;
+  }
+
+  vector<unsigned> split_numbers(const string& s) {
+    vector<unsigned> numbers;
+    for(const string& part : split(s)) {
+      unsigned n=std::strtoul(part.c_str(),nullptr,10);
+      if(n==0)
+        throw std::runtime_error("Not a positive number: "+part);
+      numbers.push_back(n);
+    }
+    return numbers;
+  }
+
+  template<typename T>
+  const T& pick(wav_synth::random& r, const vector<T>& v) {
+    return v[r.next()%v.size()];
+  }
+
+  // many short files and few long ones with log and more so with pareto, whose tail is cut off at
+  // the maximum
+  double duration(const options& o, wav_synth::random& r) {
+    double u=r.uniform();
+    if(o.durations==distribution::uniform)
+      return o.min_seconds+u*(o.max_seconds-o.min_seconds);
+    if(o.durations==distribution::log)
+      return o.min_seconds*std::pow(o.max_seconds/o.min_seconds,u);
+    // shape 1.16: 80% of the audio in 20% of the files
+    return std::min(o.max_seconds,o.min_seconds/std::pow(1-u,1/1.16));
+  }
+
+  string le32(uint32_t v) {
+    string s;
+    for(int i=0;i<4;++i,v>>=8)
+      s.push_back((char)(v&0xff));
+    return s;
+  }
+
+  wav_synth::chunk make_chunk(const string& id, const string& content) {
+    return wav_synth::chunk{id,vector<uint8_t>(content.begin(),content.end())};
+  }
+
+  // a few of the chunks real files carry before the samples, of odd sizes as often as not
+  vector<wav_synth::chunk> extra_chunks(wav_synth::random& r, uint64_t num_frames) {
+    vector<wav_synth::chunk> chunks;
+    while(chunks.empty()) {
+      if(r.next()%2) {
+        // LIST INFO with a NUL terminated software name
+        string name=r.next()%2 ? "wav2mp3_corpus" : "wav2mp3 corpus";
+        string info=string("INFOISFT",8);
+        uint32_t size=name.size()+1;
+        info+=le32(size);
+        info.append(name.c_str(),size);
+        if(size&1)
+          info.push_back('\0');
+        chunks.push_back(make_chunk("LIST",info));
+      }
+      if(r.next()%2)
+        chunks.push_back(make_chunk("fact",le32((uint32_t)std::min<uint64_t>(num_frames,0xFFFFFFFFu))));
+      if(r.next()%2)
+        chunks.push_back(make_chunk("JUNK",string(1+r.next()%64,'\0')));
+    }
+    std::swap(chunks.front(),chunks[r.next()%chunks.size()]);
+    return chunks;
+  }
+
+  const char* signal_name(wav_synth::signal s) {
+    const char* names[]={"sine","sweep","noise","silence"};
+    return names[(int)s];
+  }
+
+  void usage(const char* name) {
+    cerr<<"usage: "<<name<<" DIR [--files N] [--seed N] [--duration MIN,MAX] [--distribution uniform|log|pareto]"<<endl
+        <<"       [--formats LIST] [--channels LIST] [--rates LIST] [--signals LIST] [--odd FRACTION] [--rf64]"<<endl
+        <<"writes N synthetic WAV files and manifest.tsv into the existing directory DIR; the same options and"<<endl
+        <<"seed give the same files. Defaults: 100 files, seed 1, 0.1 to 60 s log-uniform, formats"<<endl
+        <<"pcm8,pcm16,pcm24,pcm32,float32,float64,alaw,ulaw, channels 1,2,6, rates 44100,"<<endl
+        <<"signals sine,sweep,noise,silence, a quarter of the files with odd chunk layouts"<<endl;
+  }
+}
+
+int main(int argc, char** argv) {
+  options o;
+  for(const wav_synth::sample_format& f : wav_synth::sample_formats)
+    o.formats.push_back(f.name);
+  try {
+    for(int i=1;i<argc;++i) {
+      string arg=argv[i];
+      bool has_value=i+1<argc;
+      if(arg=="--files" && has_value)
+        o.files=std::strtoul(argv[++i],nullptr,10);
+      else if(arg=="--seed" && has_value)
+        o.seed=std::strtoull(argv[++i],nullptr,10);
+      else if(arg=="--duration" && has_value) {
+        vector<string> range=split(argv[++i]);
+        o.min_seconds=std::atof(range.front().c_str());
+        o.max_seconds=std::atof(range.back().c_str());
+      }
+      else if(arg=="--distribution" && has_value) {
+        string d=argv[++i];
+        if(d=="uniform")
+          o.durations=distribution::uniform;
+        else if(d=="log")
+          o.durations=distribution::log;
+        else if(d=="pareto")
+          o.durations=distribution::pareto;
+        else
+          throw std::runtime_error("Unknown distribution "+d);
+      }
+      else if(arg=="--formats" && has_value) {
+        o.formats=split(argv[++i]);
+        for(const string& f : o.formats)
+          wav_synth::parse_sample_format(f);
+      }
+      else if(arg=="--channels" && has_value)
+        o.channels=split_numbers(argv[++i]);
+      else if(arg=="--rates" && has_value)
+        o.rates=split_numbers(argv[++i]);
+      else if(arg=="--signals" && has_value) {
+        o.signals.clear();
+        for(const string& s : split(argv[++i]))
+          o.signals.push_back(wav_synth::parse_signal(s));
+      }
+      else if(arg=="--odd" && has_value)
+        o.odd=std::atof(argv[++i]);
+      else if(arg=="--rf64")
+        o.rf64=true;
+      else if(arg[0]!='-' && o.dir.empty())
+        o.dir=arg;
+      else {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    if(o.dir.empty() || o.min_seconds<=0 || o.max_seconds<o.min_seconds) {
+      usage(argv[0]);
+      return 2;
+    }
+
+    std::ofstream manifest(o.dir+"/manifest.tsv");
+    if(!manifest)
+      throw std::runtime_error("Can't write to "+o.dir);
+    manifest<<"file\tformat\tchannels\trate\tframes\tseconds\tsignal\tlayout"<<endl;
+
+    // every choice comes from one sequence, so a file only depends on the seed and the options
+    wav_synth::random r(o.seed);
+    uint64_t total_bytes=0;
+    double total_seconds=0;
+    vector<char> buffer(1<<20);
+    for(unsigned i=0;i<o.files;++i) {
+      const wav_synth::sample_format& sf=wav_synth::parse_sample_format(pick(r,o.formats));
+      wav_synth::format f{sf.format_code,sf.bits,pick(r,o.channels),pick(r,o.rates),false};
+      wav_synth::signal s=pick(r,o.signals);
+      uint64_t num_frames=std::max<uint64_t>(1,std::llround(duration(o,r)*f.sample_rate));
+      uint64_t signal_seed=r.next();
+
+      // more than two channels need a channel mask
+      f.extensible=f.channels>2;
+      wav_synth::layout l;
+      l.rf64=o.rf64;
+      string description;
+      if(r.uniform()<o.odd) {
+        l.extra=extra_chunks(r,num_frames);
+        for(const wav_synth::chunk& c : l.extra)
+          description+=c.id+(c.content.size()&1 ? "(odd)," : ",");
+        l.fmt_after_data=r.next()%2;
+        if(l.fmt_after_data)
+          description+="fmt-after-data,";
+        f.extensible=f.extensible || r.next()%2;
+        l.fmt_extension=!f.extensible && r.next()%2;
+        if(l.fmt_extension)
+          description+="cbSize,";
+      }
+      if(f.extensible)
+        description+="extensible,";
+      if(wav_synth::is_rf64(f,num_frames,l))
+        description+="rf64,";
+      if(!description.empty())
+        description.pop_back();
+
+      char name[64];
+      snprintf(name,sizeof(name),"%05u_%s_%uch_%u.wav",i,sf.name,f.channels,f.sample_rate);
+      std::ofstream out;
+      out.rdbuf()->pubsetbuf(buffer.data(),buffer.size());
+      out.open(o.dir+"/"+name,std::ios::binary);
+      wav_synth::write_wav(out,f,num_frames,s,signal_seed,l);
+      out.close();
+      if(!out)
+        throw std::runtime_error(string("Error writing ")+name);
+
+      double seconds=(double)num_frames/f.sample_rate;
+      manifest<<name<<"\t"<<sf.name<<"\t"<<f.channels<<"\t"<<f.sample_rate<<"\t"<<num_frames<<"\t"<<seconds
+              <<"\t"<<signal_name(s)<<"\t"<<(description.empty() ? "-" : description)<<endl;
+      total_bytes+=wav_synth::riff_size(f,num_frames,l)+8+(wav_synth::is_rf64(f,num_frames,l) ? 36 : 0);
+      total_seconds+=seconds;
+    }
+    cout<<o.files<<" files, "<<total_bytes/(1024*1024)<<" MiB, "<<std::llround(total_seconds)<<" s of audio"<<endl;
+  }
+  catch(const std::exception& e) {
+    cerr<<e.what()<<endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,304 @@
+#ifndef WAV_SYNTH_H
+#define WAV_SYNTH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "pcm.h"
+#include "wav.h"
+
+//! synthetic WAV files for the benchmark and corpus tools: deterministic signals in every
+//! sample format the converter supports, written block by block to a stream
+namespace wav_synth {
+  struct format {
+    uint16_t format_code;
+    //! bits per sample of the container: 8, 16, 24, 32 or 64
+    unsigned bits;
+    unsigned channels;
+    unsigned sample_rate;
+    //! wrap the format in WAVE_FORMAT_EXTENSIBLE
+    bool extensible;
+  };
+
+  //! the sample formats the converter supports, by name
+  struct sample_format {
+    const char* name;
+    uint16_t format_code;
+    unsigned bits;
+  };
+
+  const sample_format sample_formats[]={
+    {"pcm8",wav::WAVE_FORMAT_PCM,8},
+    {"pcm16",wav::WAVE_FORMAT_PCM,16},
+    {"pcm24",wav::WAVE_FORMAT_PCM,24},
+    {"pcm32",wav::WAVE_FORMAT_PCM,32},
+    {"float32",wav::WAVE_FORMAT_IEEE_FLOAT,32},
+    {"float64",wav::WAVE_FORMAT_IEEE_FLOAT,64},
+    {"alaw",wav::WAVE_FORMAT_ALAW,8},
+    {"ulaw",wav::WAVE_FORMAT_MULAW,8},
+  };
+
+  inline const sample_format& parse_sample_format(const std::string& s) {
+    for(const sample_format& f : sample_formats)
+      if(s==f.name)
+        return f;
+    throw std::runtime_error("Unknown sample format "+s);
+  }
+
+  enum class signal { sine, sweep, noise, silence };
+
+  inline signal parse_signal(const std::string& s) {
+    if(s=="sine")
+      return signal::sine;
+    if(s=="sweep")
+      return signal::sweep;
+    if(s=="noise")
+      return signal::noise;
+    if(s=="silence")
+      return signal::silence;
+    throw std::runtime_error("Unknown signal "+s);
+  }
+
+  //! xorshift64*, the same sequence for the same seed everywhere
+  class random {
+  public:
+    explicit random(uint64_t seed) : state_(seed*0x9E3779B97F4A7C15ull+1) {}
+    uint64_t next() {
+      state_^=state_>>12;
+      state_^=state_<<25;
+      state_^=state_>>27;
+      return state_*0x2545F4914F6CDD1Dull;
+    }
+    //! uniform in [0,1)
+    double uniform() {
+      return (next()>>11)*(1.0/9007199254740992.0);
+    }
+  private:
+    uint64_t state_;
+  };
+
+  //! interleaved samples in [-1,1), channel c of the sine a little higher than channel 0
+  class generator {
+  public:
+    generator(signal s, unsigned sample_rate, unsigned channels, uint64_t seed)
+      : signal_(s), rate_(sample_rate), channels_(channels), random_(seed), frame_(0), phase_(channels,0.0) {}
+    void fill(float* out, size_t num_frames) {
+      const double pi=3.14159265358979323846;
+      for(size_t i=0;i<num_frames;++i,++frame_) {
+        double t=(double)frame_/rate_;
+        for(unsigned c=0;c<channels_;++c) {
+          double v=0;
+          if(signal_==signal::sine || signal_==signal::sweep) {
+            // the sweep goes from 20 Hz to 20 kHz and back every 10 s, exponentially
+            double hz=signal_==signal::sine ? 440+110*c : 20*std::pow(1000.0,1-std::fabs(std::fmod(t,10.0)/5-1));
+            v=0.5*std::sin(phase_[c]);
+            phase_[c]=std::fmod(phase_[c]+2*pi*hz/rate_,2*pi);
+          }
+          else if(signal_==signal::noise)
+            v=0.5*(2*random_.uniform()-1);
+          out[i*channels_+c]=(float)v;
+        }
+      }
+    }
+  private:
+    signal signal_;
+    unsigned rate_;
+    unsigned channels_;
+    random random_;
+    uint64_t frame_;
+    std::vector<double> phase_;
+  };
+
+  //! nearest G.711 code of a 16 bit sample, found through the decoder so both agree
+  class g711_encoder {
+  public:
+    explicit g711_encoder(short (*decode)(uint8_t)) : codes_(65536) {
+      std::vector<std::pair<int,uint8_t>> levels;
+      for(int i=0;i<256;++i)
+        levels.push_back(std::make_pair((int)decode((uint8_t)i),(uint8_t)i));
+      std::sort(levels.begin(),levels.end());
+      size_t k=0;
+      for(int x=-32768;x<32768;++x) {
+        while(k+1<levels.size() && std::abs(levels[k+1].first-x)<=std::abs(levels[k].first-x))
+          ++k;
+        codes_[x+32768]=levels[k].second;
+      }
+    }
+    uint8_t operator()(short x) const {
+      return codes_[x+32768];
+    }
+  private:
+    std::vector<uint8_t> codes_;
+  };
+
+  inline void put_le(std::ostream& out, uint64_t v, unsigned bytes) {
+    char b[8];
+    for(unsigned i=0;i<bytes;++i,v>>=8)
+      b[i]=(char)(v&0xff);
+    out.write(b,bytes);
+  }
+
+  //! a chunk readers skip, such as LIST, fact or JUNK; an odd size gets a pad byte
+  struct chunk {
+    //! four characters
+    std::string id;
+    std::vector<uint8_t> content;
+  };
+
+  //! order and kind of the chunks around the samples
+  struct layout {
+    layout() : fmt_after_data(false), fmt_extension(false), rf64(false) {}
+    //! chunks right before the data chunk
+    std::vector<chunk> extra;
+    //! the fmt chunk follows the data chunk, only seekable input can be read like that
+    bool fmt_after_data;
+    //! a cbSize of 0 after the 16 bytes of a fmt chunk that isn't extensible
+    bool fmt_extension;
+    //! RF64 with a ds64 chunk even if the file would fit RIFF; files beyond 4 GiB are always RF64
+    bool rf64;
+  };
+
+  inline uint64_t padded(uint64_t size) {
+    return size+(size&1);
+  }
+
+  inline uint64_t data_size(const format& f, uint64_t num_frames) {
+    return num_frames*(f.bits/8)*f.channels;
+  }
+
+  inline unsigned fmt_size(const format& f, const layout& l) {
+    return f.extensible ? 40 : l.fmt_extension ? 18 : 16;
+  }
+
+  //! RIFF size field: everything after it
+  inline uint64_t riff_size(const format& f, uint64_t num_frames, const layout& l) {
+    uint64_t size=4+8+fmt_size(f,l)+8+padded(data_size(f,num_frames));
+    for(const chunk& c : l.extra)
+      size+=8+padded(c.content.size());
+    return size;
+  }
+
+  inline bool is_rf64(const format& f, uint64_t num_frames, const layout& l) {
+    return l.rf64 || riff_size(f,num_frames,l)>0xFFFFFFFFull;
+  }
+
+  inline void write_fmt(std::ostream& out, const format& f, const layout& l) {
+    unsigned block=f.bits/8;
+    out.write("fmt ",4);
+    put_le(out,fmt_size(f,l),4);
+    put_le(out,f.extensible ? wav::WAVE_FORMAT_EXTENSIBLE : f.format_code,2);
+    put_le(out,f.channels,2);
+    put_le(out,f.sample_rate,4);
+    put_le(out,(uint64_t)f.sample_rate*block*f.channels,4);
+    put_le(out,block*f.channels,2);
+    put_le(out,f.bits,2);
+    if(f.extensible) {
+      put_le(out,22,2);
+      put_le(out,f.bits,2);
+      // the first channels of FL FR FC LFE BL BR ...
+      put_le(out,f.channels>=32 ? 0xFFFFFFFFu : (1u<<f.channels)-1,4);
+      // subformat GUID: the format code followed by the fixed KSDATAFORMAT suffix
+      static const uint8_t suffix[14]={0x00,0x00,0x00,0x00,0x10,0x00,0x80,0x00,0x00,0xAA,0x00,0x38,0x9B,0x71};
+      put_le(out,f.format_code,2);
+      out.write((const char*)suffix,sizeof(suffix));
+    }
+    else if(l.fmt_extension)
+      put_le(out,0,2);
+  }
+
+  //! writes everything up to and including the data chunk header for num_frames frames
+  inline void write_header(std::ostream& out, const format& f, uint64_t num_frames, const layout& l = layout()) {
+    uint64_t size=riff_size(f,num_frames,l);
+    uint64_t data=data_size(f,num_frames);
+    bool rf64=is_rf64(f,num_frames,l);
+    // ds64: RIFF size, data size, sample count and an empty table of other chunk sizes
+    if(rf64)
+      size+=8+28;
+    out.write(rf64 ? "RF64" : "RIFF",4);
+    put_le(out,rf64 ? 0xFFFFFFFFu : size,4);
+    out.write("WAVE",4);
+    if(rf64) {
+      out.write("ds64",4);
+      put_le(out,28,4);
+      put_le(out,size,8);
+      put_le(out,data,8);
+      put_le(out,num_frames,8);
+      put_le(out,0,4);
+    }
+    if(!l.fmt_after_data)
+      write_fmt(out,f,l);
+    for(const chunk& c : l.extra) {
+      out.write(c.id.data(),4);
+      put_le(out,c.content.size(),4);
+      out.write((const char*)c.content.data(),c.content.size());
+      if(c.content.size()&1)
+        out.put('\0');
+    }
+    out.write("data",4);
+    put_le(out,rf64 ? 0xFFFFFFFFu : data,4);
+  }
+
+  //! quantizes interleaved samples in [-1,1) into the sample format of f
+  inline void encode(const format& f, const float* in, size_t num_samples, std::vector<uint8_t>& out) {
+    static const g711_encoder alaw(pcm::alaw_sample);
+    static const g711_encoder ulaw(pcm::ulaw_sample);
+    unsigned block=f.bits/8;
+    out.resize(num_samples*block);
+    uint8_t* p=out.data();
+    for(size_t i=0;i<num_samples;++i,p+=block) {
+      double v=std::max(-1.0,std::min(1.0,(double)in[i]));
+      if(f.format_code==wav::WAVE_FORMAT_IEEE_FLOAT && block==4) {
+        float x=(float)v;
+        uint32_t u;
+        memcpy(&u,&x,4);
+        for(unsigned b=0;b<4;++b)
+          p[b]=(uint8_t)(u>>(8*b));
+      }
+      else if(f.format_code==wav::WAVE_FORMAT_IEEE_FLOAT) {
+        uint64_t u;
+        memcpy(&u,&v,8);
+        for(unsigned b=0;b<8;++b)
+          p[b]=(uint8_t)(u>>(8*b));
+      }
+      else if(f.format_code==wav::WAVE_FORMAT_ALAW)
+        p[0]=alaw((short)std::lrint(v*32767));
+      else if(f.format_code==wav::WAVE_FORMAT_MULAW)
+        p[0]=ulaw((short)std::lrint(v*32767));
+      else if(block==1)
+        // 8 bit PCM is unsigned
+        p[0]=(uint8_t)(std::lrint(v*127)+128);
+      else {
+        int64_t x=std::llrint(v*(double)((1ull<<(f.bits-1))-1));
+        for(unsigned b=0;b<block;++b)
+          p[b]=(uint8_t)((uint64_t)x>>(8*b));
+      }
+    }
+  }
+
+  //! writes a complete file of num_frames frames of s, block by block
+  inline void write_wav(std::ostream& out, const format& f, uint64_t num_frames, signal s, uint64_t seed,
+                        const layout& l = layout()) {
+    const size_t block_frames=4096;
+    write_header(out,f,num_frames,l);
+    generator g(s,f.sample_rate,f.channels,seed);
+    std::vector<float> samples(block_frames*f.channels);
+    std::vector<uint8_t> bytes;
+    for(uint64_t done=0;done<num_frames;) {
+      size_t n=(size_t)std::min<uint64_t>(block_frames,num_frames-done);
+      g.fill(samples.data(),n);
+      encode(f,samples.data(),n*f.channels,bytes);
+      out.write((const char*)bytes.data(),bytes.size());
+      done+=n;
+    }
+    if(data_size(f,num_frames)&1)
+      out.put('\0');
+    if(l.fmt_after_data)
+      write_fmt(out,f,l);
+  }
+}
+#endif